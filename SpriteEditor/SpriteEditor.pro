@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -28,15 +28,35 @@ SOURCES += \
         main.cpp \
         spriteeditorwindow.cpp \
     frame.cpp \
+    layer.cpp \
+    blend.cpp \
+    layerpanel.cpp \
+    canvas.cpp \
+    edithistory.cpp \
     spritemodel.cpp \
-    popup.cpp
+    popup.cpp \
+    projectfile.cpp \
+    autosave.cpp \
+    exporter.cpp \
+    batchexport.cpp \
+    atlas.cpp
 
 HEADERS += \
         spriteeditorwindow.h \
     frame.h \
+    layer.h \
+    blend.h \
+    layerpanel.h \
+    canvas.h \
+    edithistory.h \
     spritemodel.h \
     popup.h \
-    gif.h
+    gif.h \
+    projectfile.h \
+    autosave.h \
+    exporter.h \
+    batchexport.h \
+    atlas.h
 
 FORMS += \
         spriteeditorwindow.ui \
@@ -0,0 +1,440 @@
+#include "atlas.h"
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QXmlStreamWriter>
+#include <QtConcurrent>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+const int Atlas::PADDING;
+
+namespace
+{
+    // FNV-1a over the trimmed pixels, to find frames that might be the same
+    quint64 hashPixels(const QImage& image)
+    {
+        quint64 hash = 14695981039346656037ULL;
+        hash = (hash ^ quint64(image.width()))*1099511628211ULL;
+        hash = (hash ^ quint64(image.height()))*1099511628211ULL;
+
+        for (int y = 0; y < image.height(); y++)
+        {
+            const uchar* line = image.constScanLine(y);
+            for (int i = 0; i < image.width()*int(sizeof(QRgb)); i++)
+            {
+                hash = (hash ^ line[i])*1099511628211ULL;
+            }
+        }
+
+        return hash;
+    }
+
+    QJsonObject rectObject(QRect rect)
+    {
+        QJsonObject object;
+        object["x"] = rect.x();
+        object["y"] = rect.y();
+        object["w"] = rect.width();
+        object["h"] = rect.height();
+        return object;
+    }
+
+    // A stretch of the top edge of the sprites packed so far
+    struct SkylineSegment
+    {
+        int x;
+        int y;
+        int width;
+    };
+
+    QString frameName(int index)
+    {
+        return QString("frame_%1").arg(index + 1);
+    }
+}
+
+Atlas::Atlas(const QVector<Frame>& frames, int padding)
+{
+    uniqueCount = 0;
+    if (frames.isEmpty())
+    {
+        return;
+    }
+
+    frameSize = frames[0].getSize();
+
+    // Flattening and trimming each frame is independent of the others, so it's
+    // done in parallel, keeping only the trimmed pixels
+    QVector<QImage> trimmed(frames.size());
+    QVector<QPoint> offsets(frames.size());
+    QVector<quint64> hashes(frames.size());
+    QImage* trimmedData = trimmed.data();
+    QPoint* offsetData = offsets.data();
+    quint64* hashData = hashes.data();
+
+    QVector<int> indexes(frames.size());
+    for (int i = 0; i < indexes.size(); i++)
+    {
+        indexes[i] = i;
+    }
+
+    QtConcurrent::blockingMap(indexes, [&](int index)
+    {
+        QImage image = frames[index].toImage();
+        QRect bounds = trim(image);
+        trimmedData[index] = image.copy(bounds);
+        offsetData[index] = bounds.topLeft();
+        hashData[index] = hashPixels(trimmedData[index]);
+    });
+
+    // Frames with the same hash are compared pixel for pixel before being shared
+    QHash<quint64, QVector<int>> candidates;
+    QVector<int> unique;
+    sprites.resize(frames.size());
+
+    for (int i = 0; i < frames.size(); i++)
+    {
+        sprites[i].offset = offsets[i];
+        sprites[i].original = i;
+
+        QVector<int>& sameHash = candidates[hashes[i]];
+        for (int other : sameHash)
+        {
+            if (samePixels(trimmed[other], trimmed[i]))
+            {
+                sprites[i].original = other;
+                break;
+            }
+        }
+
+        if (sprites[i].original == i)
+        {
+            sameHash.append(i);
+            unique.append(i);
+        }
+    }
+
+    uniqueCount = unique.size();
+
+    QVector<QSize> sizes(unique.size());
+    QVector<int> order(unique.size());
+    qint64 totalArea = 0;
+    int widest = 0;
+
+    for (int i = 0; i < unique.size(); i++)
+    {
+        sizes[i] = trimmed[unique[i]].size() + QSize(padding, padding);
+        order[i] = i;
+        totalArea += qint64(sizes[i].width())*sizes[i].height();
+        widest = std::max(widest, sizes[i].width());
+    }
+
+    // Tallest first keeps the skyline flat, which wastes the least space under it
+    std::sort(order.begin(), order.end(), [&](int first, int second)
+    {
+        if (sizes[first].height() != sizes[second].height())
+        {
+            return sizes[first].height() > sizes[second].height();
+        }
+
+        return sizes[first].width() > sizes[second].width();
+    });
+
+    // The best width is rarely exactly square, so a few around it are tried and
+    // the one giving the smallest atlas kept. Each try is a single pass.
+    int side = int(std::ceil(std::sqrt(double(totalArea))));
+    const double widthFactors[] = { 1.0, 1.1, 1.25, 1.5, 2.0 };
+
+    QVector<QPoint> positions;
+    QSize atlasSize;
+    qint64 bestArea = LLONG_MAX;
+
+    for (double factor : widthFactors)
+    {
+        int binWidth = std::max(widest, int(side*factor));
+        QVector<QPoint> tried;
+        int height = pack(sizes, order, binWidth, tried);
+
+        // Padding is only needed between sprites, not after the last ones
+        int usedWidth = 0;
+        for (int i = 0; i < tried.size(); i++)
+        {
+            usedWidth = std::max(usedWidth, tried[i].x() + sizes[i].width());
+        }
+
+        QSize size(std::max(1, usedWidth - padding), std::max(1, height - padding));
+        qint64 area = qint64(size.width())*size.height();
+        if (area < bestArea)
+        {
+            bestArea = area;
+            atlasSize = size;
+            positions = tried;
+        }
+    }
+
+    image = QImage(atlasSize, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    for (int i = 0; i < unique.size(); i++)
+    {
+        const QImage& sprite = trimmed[unique[i]];
+        QPoint position = positions[i];
+
+        for (int y = 0; y < sprite.height(); y++)
+        {
+            std::memcpy(image.scanLine(position.y() + y) + position.x()*sizeof(QRgb), sprite.constScanLine(y),
+                        sprite.width()*sizeof(QRgb));
+        }
+
+        sprites[unique[i]].rect = QRect(position, sprite.size());
+    }
+
+    for (Sprite& sprite : sprites)
+    {
+        sprite.rect = sprites[sprite.original].rect;
+    }
+}
+
+const QImage& Atlas::getImage() const
+{
+    return image;
+}
+
+QSize Atlas::getFrameSize() const
+{
+    return frameSize;
+}
+
+const QVector<Atlas::Sprite>& Atlas::getSprites() const
+{
+    return sprites;
+}
+
+int Atlas::getUniqueCount() const
+{
+    return uniqueCount;
+}
+
+QRect Atlas::trim(const QImage& image)
+{
+    // Rows are scanned in from the top and bottom until one has something in it,
+    // and only the rows between for the left and right edges
+    auto isBlankRow = [&](int y)
+    {
+        const QRgb* line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+        for (int x = 0; x < image.width(); x++)
+        {
+            if (qAlpha(line[x]) != 0)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    int top = 0;
+    while (top < image.height() && isBlankRow(top))
+    {
+        top++;
+    }
+
+    // Blank frames keep a single transparent pixel, so every frame has a sprite
+    if (top == image.height())
+    {
+        return QRect(0, 0, 1, 1);
+    }
+
+    int bottom = image.height() - 1;
+    while (isBlankRow(bottom))
+    {
+        bottom--;
+    }
+
+    int left = image.width();
+    int right = -1;
+    for (int y = top; y <= bottom; y++)
+    {
+        const QRgb* line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+        for (int x = 0; x < left; x++)
+        {
+            if (qAlpha(line[x]) != 0)
+            {
+                left = x;
+                break;
+            }
+        }
+
+        for (int x = image.width() - 1; x > right; x--)
+        {
+            if (qAlpha(line[x]) != 0)
+            {
+                right = x;
+                break;
+            }
+        }
+    }
+
+    return QRect(QPoint(left, top), QPoint(right, bottom));
+}
+
+bool Atlas::samePixels(const QImage& first, const QImage& second)
+{
+    if (first.size() != second.size())
+    {
+        return false;
+    }
+
+    for (int y = 0; y < first.height(); y++)
+    {
+        if (std::memcmp(first.constScanLine(y), second.constScanLine(y), first.width()*sizeof(QRgb)) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int Atlas::pack(const QVector<QSize>& sizes, const QVector<int>& order, int binWidth, QVector<QPoint>& positions)
+{
+    // The top edge of everything placed so far, left to right
+    QVector<SkylineSegment> skyline;
+    skyline.append({ 0, 0, binWidth });
+    positions.resize(sizes.size());
+    int height = 0;
+
+    for (int index : order)
+    {
+        QSize size = sizes[index];
+        int bestSegment = -1;
+        int bestY = 0;
+        int bestTop = INT_MAX;
+
+        for (int i = 0; i < skyline.size() && skyline[i].x + size.width() <= binWidth; i++)
+        {
+            // A sprite starting here rests on the highest segment under it
+            int y = 0;
+            int covered = 0;
+            for (int j = i; covered < size.width(); j++)
+            {
+                y = std::max(y, skyline[j].y);
+                covered += skyline[j].width;
+            }
+
+            if (y + size.height() < bestTop)
+            {
+                bestSegment = i;
+                bestY = y;
+                bestTop = y + size.height();
+            }
+        }
+
+        SkylineSegment placed = { skyline[bestSegment].x, bestTop, size.width() };
+        positions[index] = QPoint(placed.x, bestY);
+        height = std::max(height, bestTop);
+
+        // The new segment replaces whatever it covers
+        skyline.insert(bestSegment, placed);
+        int i = bestSegment + 1;
+        while (i < skyline.size() && skyline[i].x < placed.x + placed.width)
+        {
+            int covered = placed.x + placed.width - skyline[i].x;
+            if (covered >= skyline[i].width)
+            {
+                skyline.remove(i);
+            }
+            else
+            {
+                skyline[i].x += covered;
+                skyline[i].width -= covered;
+                break;
+            }
+        }
+
+        for (int j = 0; j + 1 < skyline.size();)
+        {
+            if (skyline[j].y == skyline[j + 1].y)
+            {
+                skyline[j].width += skyline[j + 1].width;
+                skyline.remove(j + 1);
+            }
+            else
+            {
+                j++;
+            }
+        }
+    }
+
+    return height;
+}
+
+QByteArray Atlas::toJson(const QString& imageName) const
+{
+    // Keyed by frame name, as TexturePacker's JSON hash format has it
+    QJsonObject frameTable;
+    for (int i = 0; i < sprites.size(); i++)
+    {
+        const Sprite& sprite = sprites[i];
+
+        QJsonObject sourceSize;
+        sourceSize["w"] = frameSize.width();
+        sourceSize["h"] = frameSize.height();
+
+        QJsonObject entry;
+        entry["frame"] = rectObject(sprite.rect);
+        entry["rotated"] = false;
+        entry["trimmed"] = sprite.rect.size() != frameSize;
+        entry["spriteSourceSize"] = rectObject(QRect(sprite.offset, sprite.rect.size()));
+        entry["sourceSize"] = sourceSize;
+        frameTable[frameName(i)] = entry;
+    }
+
+    QJsonObject size;
+    size["w"] = image.width();
+    size["h"] = image.height();
+
+    QJsonObject meta;
+    meta["app"] = "SpriteEditor";
+    meta["image"] = imageName;
+    meta["format"] = "RGBA8888";
+    meta["size"] = size;
+    meta["scale"] = "1";
+
+    QJsonObject root;
+    root["frames"] = frameTable;
+    root["meta"] = meta;
+    return QJsonDocument(root).toJson();
+}
+
+QByteArray Atlas::toXml(const QString& imageName) const
+{
+    QByteArray xml;
+    QXmlStreamWriter writer(&xml);
+    writer.setAutoFormatting(true);
+    writer.writeStartDocument();
+    writer.writeStartElement("TextureAtlas");
+    writer.writeAttribute("imagePath", imageName);
+
+    for (int i = 0; i < sprites.size(); i++)
+    {
+        const Sprite& sprite = sprites[i];
+        writer.writeEmptyElement("SubTexture");
+        writer.writeAttribute("name", frameName(i));
+        writer.writeAttribute("x", QString::number(sprite.rect.x()));
+        writer.writeAttribute("y", QString::number(sprite.rect.y()));
+        writer.writeAttribute("width", QString::number(sprite.rect.width()));
+        writer.writeAttribute("height", QString::number(sprite.rect.height()));
+        writer.writeAttribute("frameX", QString::number(-sprite.offset.x()));
+        writer.writeAttribute("frameY", QString::number(-sprite.offset.y()));
+        writer.writeAttribute("frameWidth", QString::number(frameSize.width()));
+        writer.writeAttribute("frameHeight", QString::number(frameSize.height()));
+    }
+
+    writer.writeEndElement();
+    writer.writeEndDocument();
+    return xml;
+}
@@ -0,0 +1,81 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <QImage>
+#include <QRect>
+#include <QSize>
+#include <QPoint>
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+#include "frame.h"
+
+/**
+ * The frames packed into one texture atlas image for game engines, with a table
+ * of where each frame ended up.
+ *
+ * Frames are trimmed to their drawn pixels first, and frames whose trimmed
+ * pixels are the same, like the held poses of an animation, are stored once and
+ * share a rectangle. What's left is packed with a skyline packer, which puts
+ * each sprite, tallest first, wherever along the top edge of what's been placed
+ * so far keeps it lowest. A few atlas widths are tried and the smallest atlas
+ * kept.
+ *
+ * The table can be written as JSON in the TexturePacker hash format, or as
+ * Starling / Sparrow XML, which most engines read.
+ */
+class Atlas
+{
+public:
+    struct Sprite
+    {
+        // Where the frame's pixels are in the atlas, a single transparent pixel for a blank frame
+        QRect rect;
+        // Where the trimmed pixels were in the frame
+        QPoint offset;
+        // Index of the first frame with the same pixels, or of this frame
+        int original;
+    };
+
+    // Transparent pixels left between sprites, so filtering doesn't bleed one into the next
+    static const int PADDING = 1;
+
+    explicit Atlas(const QVector<Frame>& frames, int padding = PADDING);
+
+    const QImage& getImage() const;
+    QSize getFrameSize() const;
+
+    /**
+     *  One sprite per frame, in frame order.
+     */
+    const QVector<Sprite>& getSprites() const;
+
+    /**
+     *  Returns how many different sprites there are in the atlas.
+     */
+    int getUniqueCount() const;
+
+    /**
+     *  The frame table, naming frames frame_1, frame_2... and referring to the
+     *  atlas as imageName.
+     */
+    QByteArray toJson(const QString& imageName) const;
+    QByteArray toXml(const QString& imageName) const;
+
+private:
+    QImage image;
+    QSize frameSize;
+    QVector<Sprite> sprites;
+    int uniqueCount;
+
+    static QRect trim(const QImage& image);
+    static bool samePixels(const QImage& first, const QImage& second);
+
+    /**
+     *  Packs sizes into a binWidth wide strip, filling in where each goes, and
+     *  returns how tall the strip ends up.
+     */
+    static int pack(const QVector<QSize>& sizes, const QVector<int>& order, int binWidth, QVector<QPoint>& positions);
+};
+
+#endif // ATLAS_H
@@ -0,0 +1,538 @@
+#include "autosave.h"
+#include "projectfile.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+
+const int Autosave::INTERVAL;
+const quint16 Autosave::VERSION;
+const quint32 Autosave::CHUNK_ENTRY;
+const quint32 Autosave::FRAMES_ENTRY;
+const quint8 Autosave::IN_BASE;
+const quint8 Autosave::IN_JOURNAL;
+const qint64 Autosave::COMPACT_SIZE;
+
+namespace
+{
+    const char JOURNAL_MAGIC[4] = { 'S', 'S', 'P', 'J' };
+
+    // type, size and checksum
+    const qint64 ENTRY_HEADER_SIZE = 2*sizeof(quint32) + sizeof(quint64);
+
+    // Only the start of the base goes into its fingerprint, with its size and
+    // modification time, so checking it doesn't read the whole file
+    const qint64 FINGERPRINT_BYTES = 64*1024;
+
+    /**
+     *  FNV-1a, to tell a journal entry that was only partly written.
+     */
+    quint64 checksum(const char* data, qint64 size, quint64 hash = 14695981039346656037ULL)
+    {
+        for (qint64 i = 0; i < size; i++)
+        {
+            hash = (hash ^ quint8(data[i]))*1099511628211ULL;
+        }
+
+        return hash;
+    }
+
+    void setError(QString* error, const QString& message)
+    {
+        if (error != nullptr)
+        {
+            *error = message;
+        }
+    }
+}
+
+Autosave::Autosave(QObject* parent) :
+    QObject(parent)
+{
+    frames = nullptr;
+    generation = 0;
+    setProjectFile(QString());
+
+    connect(&watcher, SIGNAL(finished()), this, SLOT(finishSave()));
+    connect(&timer, SIGNAL(timeout()), this, SLOT(save()));
+    timer.start(INTERVAL);
+}
+
+Autosave::~Autosave()
+{
+    watcher.waitForFinished();
+}
+
+void Autosave::setFrames(const QVector<Frame>* frames)
+{
+    this->frames = frames;
+}
+
+void Autosave::setProjectFile(const QString& fileName)
+{
+    waitForFinished();
+    projectName = fileName;
+
+    QString prefix = fileName;
+    if (prefix.isEmpty())
+    {
+        QString folder = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+        QDir().mkpath(folder);
+        prefix = folder + "/untitled.ssp";
+    }
+
+    autosaveName = prefix + ".autosave";
+    journalName = prefix + ".journal";
+    reset();
+}
+
+void Autosave::reset()
+{
+    savedRevisions.clear();
+    savedFrames.clear();
+    baseName.clear();
+    baseFingerprint = 0;
+    baseSize = 0;
+    journalSize = 0;
+    generation++;
+}
+
+void Autosave::markSaved(const QVector<Frame>& saved)
+{
+    waitForFinished();
+    reset();
+    if (projectName.isEmpty())
+    {
+        return;
+    }
+
+    baseName = projectName;
+    baseFingerprint = fingerprint(baseName, &baseSize);
+    for (int i = 0; i < saved.size(); i++)
+    {
+        Location location = { IN_BASE, quint64(i) };
+        savedRevisions.insert(saved[i].getRevision(), location);
+        savedFrames.append(saved[i].getRevision());
+    }
+}
+
+bool Autosave::hasRecovery() const
+{
+    return QFile::exists(autosaveName) || QFile::exists(journalName);
+}
+
+void Autosave::discard()
+{
+    waitForFinished();
+    QFile::remove(journalName);
+    QFile::remove(autosaveName);
+    reset();
+}
+
+void Autosave::waitForFinished()
+{
+    if (watcher.isRunning())
+    {
+        watcher.waitForFinished();
+        finishSave();
+    }
+}
+
+void Autosave::save()
+{
+    if (frames == nullptr || frames->isEmpty() || watcher.isRunning())
+    {
+        return;
+    }
+
+    QVector<quint64> revisions;
+    revisions.reserve(frames->size());
+    for (const Frame& frame : *frames)
+    {
+        revisions.append(frame.getRevision());
+    }
+
+    // A fresh project isn't worth a file until something's been drawn in it
+    bool isBlank = projectName.isEmpty() && savedFrames.isEmpty();
+    for (int i = 0; isBlank && i < frames->size(); i++)
+    {
+        isBlank = frames->at(i).isLoaded() && frames->at(i).getAllocatedTileCount() == 0;
+    }
+
+    if (revisions == savedFrames || isBlank)
+    {
+        return;
+    }
+
+    Job job;
+    // Detached here, so the worker reads frames of its own while the canvas draws on these
+    job.frames = *frames;
+    job.frames.detach();
+    job.savedRevisions = savedRevisions;
+    job.baseName = baseName;
+    job.autosaveName = autosaveName;
+    job.journalName = journalName;
+    job.baseFingerprint = baseFingerprint;
+    job.baseSize = baseSize;
+    job.journalSize = journalSize;
+    job.compact = baseName.isEmpty() || journalSize > std::max(baseSize, COMPACT_SIZE);
+    job.generation = generation;
+
+    watcher.setFuture(QtConcurrent::run(&Autosave::write, job));
+}
+
+void Autosave::finishSave()
+{
+    Result result = watcher.result();
+    if (result.generation != generation)
+    {
+        return;
+    }
+
+    if (!result.succeeded)
+    {
+        // The files may no longer go together, so the next autosave starts them over
+        qWarning("Autosave failed: %s", qPrintable(result.error));
+        baseName.clear();
+        return;
+    }
+
+    savedRevisions = result.savedRevisions;
+    savedFrames = result.revisions;
+    baseName = result.baseName;
+    baseFingerprint = result.baseFingerprint;
+    baseSize = result.baseSize;
+    journalSize = result.journalSize;
+}
+
+Autosave::Result Autosave::write(Job job)
+{
+    Result result;
+    result.succeeded = false;
+    result.savedRevisions = job.savedRevisions;
+    result.baseName = job.baseName;
+    result.baseFingerprint = job.baseFingerprint;
+    result.baseSize = job.baseSize;
+    result.journalSize = job.journalSize;
+    result.generation = job.generation;
+
+    for (const Frame& frame : job.frames)
+    {
+        result.revisions.append(frame.getRevision());
+    }
+
+    if (job.compact)
+    {
+        // The new base holds everything, so the journal starts out empty. A crash
+        // before it's replaced leaves a journal of the old base, which gets ignored.
+        if (!ProjectFile::save(job.autosaveName, job.frames, &result.error, true))
+        {
+            return result;
+        }
+
+        result.baseName = job.autosaveName;
+        result.baseFingerprint = fingerprint(result.baseName, &result.baseSize);
+        if (!startJournal(job.journalName, result.baseName, result.baseFingerprint, &result.journalSize, &result.error))
+        {
+            return result;
+        }
+
+        result.savedRevisions.clear();
+        for (int i = 0; i < job.frames.size(); i++)
+        {
+            Location location = { IN_BASE, quint64(i) };
+            result.savedRevisions.insert(job.frames[i].getRevision(), location);
+        }
+
+        result.succeeded = true;
+        return result;
+    }
+
+    if (result.journalSize == 0 &&
+            !startJournal(job.journalName, result.baseName, result.baseFingerprint, &result.journalSize, &result.error))
+    {
+        return result;
+    }
+
+    QFile journal(job.journalName);
+    if (!journal.open(QIODevice::ReadWrite) || !journal.resize(result.journalSize) || !journal.seek(result.journalSize))
+    {
+        result.error = journal.errorString();
+        return result;
+    }
+
+    QByteArray list;
+    QDataStream stream(&list, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream << quint32(job.frames[0].getWidth()) << quint32(job.frames[0].getHeight()) << quint32(job.frames.size());
+
+    for (const Frame& frame : job.frames)
+    {
+        // Frames that haven't changed are already saved somewhere, so only what was
+        // drawn since the last autosave gets encoded
+        if (!result.savedRevisions.contains(frame.getRevision()))
+        {
+            Location location = { IN_JOURNAL, quint64(journal.pos()) };
+            if (!appendEntry(journal, CHUNK_ENTRY, ProjectFile::encodeFrame(frame)))
+            {
+                result.error = journal.errorString();
+                return result;
+            }
+
+            result.savedRevisions.insert(frame.getRevision(), location);
+        }
+
+        Location location = result.savedRevisions.value(frame.getRevision());
+        stream << location.place;
+        if (location.place == IN_BASE)
+        {
+            stream << quint32(location.position);
+        }
+        else
+        {
+            stream << location.position;
+        }
+    }
+
+    if (!appendEntry(journal, FRAMES_ENTRY, list) || !journal.flush())
+    {
+        result.error = journal.errorString();
+        return result;
+    }
+
+    result.journalSize = journal.pos();
+    result.succeeded = true;
+    return result;
+}
+
+bool Autosave::startJournal(const QString& journalName, const QString& baseName, quint64 baseFingerprint,
+                            qint64* size, QString* error)
+{
+    QSaveFile journal(journalName);
+    if (!journal.open(QIODevice::WriteOnly))
+    {
+        setError(error, journal.errorString());
+        return false;
+    }
+
+    QDataStream stream(&journal);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.writeRawData(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    stream << VERSION << quint16(0) << baseFingerprint << baseName;
+
+    *size = journal.pos();
+    if (stream.status() != QDataStream::Ok || !journal.commit())
+    {
+        setError(error, journal.errorString());
+        return false;
+    }
+
+    return true;
+}
+
+bool Autosave::appendEntry(QFile& journal, quint32 type, const QByteArray& entry)
+{
+    QByteArray header;
+    QDataStream stream(&header, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream << type << quint32(entry.size()) << checksum(entry.constData(), entry.size());
+
+    return journal.write(header) == header.size() && journal.write(entry) == entry.size();
+}
+
+quint64 Autosave::fingerprint(const QString& fileName, qint64* size)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return 0;
+    }
+
+    qint64 fileSize = file.size();
+    qint64 modified = QFileInfo(file).lastModified().toMSecsSinceEpoch();
+    QByteArray start = file.read(FINGERPRINT_BYTES);
+
+    if (size != nullptr)
+    {
+        *size = fileSize;
+    }
+
+    quint64 hash = checksum(reinterpret_cast<const char*>(&fileSize), sizeof(fileSize));
+    hash = checksum(reinterpret_cast<const char*>(&modified), sizeof(modified), hash);
+    return checksum(start.constData(), start.size(), hash);
+}
+
+bool Autosave::recover(QVector<Frame>& frames, QString* error)
+{
+    waitForFinished();
+
+    // The journal is only any use if its base is still the file it was written against
+    QString journalBase;
+    quint64 journalFingerprint = 0;
+
+    QSharedPointer<ProjectSource> journal(new ProjectSource(journalName));
+    QHash<quint64, int> chunks;
+    QByteArray list;
+    qint64 end = 0;
+
+    if (QFile::exists(journalName) && journal->open(nullptr))
+    {
+        QByteArray bytes = QByteArray::fromRawData(journal->getData(), int(journal->getSize()));
+        QDataStream stream(bytes);
+        stream.setByteOrder(QDataStream::LittleEndian);
+
+        char magic[sizeof(JOURNAL_MAGIC)];
+        quint16 version = 0;
+        quint16 reserved;
+        if (stream.readRawData(magic, sizeof(magic)) == int(sizeof(magic))
+                && std::memcmp(magic, JOURNAL_MAGIC, sizeof(magic)) == 0)
+        {
+            stream >> version >> reserved >> journalFingerprint >> journalBase;
+        }
+
+        if (stream.status() == QDataStream::Ok && version == VERSION && !journalBase.isEmpty()
+                && fingerprint(journalBase) == journalFingerprint)
+        {
+            journal->setVersion(ProjectFile::VERSION);
+            end = stream.device()->pos();
+
+            // Entries after a torn or damaged one can't be trusted to be complete
+            while (end + ENTRY_HEADER_SIZE <= journal->getSize())
+            {
+                quint32 type;
+                quint32 size;
+                quint64 sum;
+                stream >> type >> size >> sum;
+
+                qint64 offset = end + ENTRY_HEADER_SIZE;
+                if (offset + size > journal->getSize() || checksum(journal->getData() + offset, size) != sum)
+                {
+                    break;
+                }
+
+                if (type == CHUNK_ENTRY)
+                {
+                    chunks.insert(quint64(end), journal->getChunkCount());
+                    journal->addChunk(offset, size);
+                }
+                else if (type == FRAMES_ENTRY)
+                {
+                    list = QByteArray(journal->getData() + offset, int(size));
+                }
+
+                end = offset + size;
+                stream.skipRawData(int(size));
+            }
+        }
+        else
+        {
+            journalBase.clear();
+        }
+    }
+
+    // Without a journal to go with it, a base left by compacting is the last autosave
+    QString recoveredBase = journalBase.isEmpty() ? autosaveName : journalBase;
+    if (journalBase.isEmpty() && !QFile::exists(autosaveName))
+    {
+        setError(error, "The autosave is out of date or damaged.");
+        return false;
+    }
+
+    QVector<Frame> baseFrames;
+    if (!ProjectFile::load(recoveredBase, baseFrames, error))
+    {
+        return false;
+    }
+
+    QVector<Frame> recovered;
+    QHash<quint64, Location> locations;
+
+    if (list.isEmpty())
+    {
+        recovered = baseFrames;
+        for (int i = 0; i < recovered.size(); i++)
+        {
+            Location location = { IN_BASE, quint64(i) };
+            locations.insert(recovered[i].getRevision(), location);
+        }
+    }
+    else
+    {
+        QDataStream stream(list);
+        stream.setByteOrder(QDataStream::LittleEndian);
+        quint32 width;
+        quint32 height;
+        quint32 count;
+        stream >> width >> height >> count;
+
+        for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++)
+        {
+            Location location;
+            stream >> location.place;
+
+            if (location.place == IN_BASE)
+            {
+                quint32 index;
+                stream >> index;
+                location.position = index;
+                if (index >= quint32(baseFrames.size()) || baseFrames[int(index)].getSize() != QSize(int(width), int(height)))
+                {
+                    break;
+                }
+
+                recovered.append(baseFrames[int(index)]);
+            }
+            else
+            {
+                stream >> location.position;
+                if (!chunks.contains(location.position) || width == 0 || height == 0
+                        || width > quint32(Frame::MAX_SIZE) || height > quint32(Frame::MAX_SIZE))
+                {
+                    break;
+                }
+
+                recovered.append(Frame::fromChunk(journal, chunks.value(location.position), int(width), int(height)));
+            }
+
+            locations.insert(recovered.last().getRevision(), location);
+        }
+
+        if (stream.status() != QDataStream::Ok || recovered.size() != int(count) || count == 0)
+        {
+            setError(error, "The autosave is damaged.");
+            return false;
+        }
+    }
+
+    // Recovered frames read from the autosave files, which are rewritten and
+    // deleted as the project goes on, so they're copied into memory
+    journal->release();
+    for (const Frame& frame : recovered)
+    {
+        if (frame.getSource() && frame.getSource()->getFileName() == autosaveName)
+        {
+            frame.getSource()->release();
+            break;
+        }
+    }
+
+    frames = recovered;
+
+    // Autosaving carries on from the journal that was recovered
+    reset();
+    savedRevisions = locations;
+    for (const Frame& frame : recovered)
+    {
+        savedFrames.append(frame.getRevision());
+    }
+
+    baseName = recoveredBase;
+    baseFingerprint = fingerprint(baseName, &baseSize);
+    journalSize = journalBase.isEmpty() ? 0 : end;
+    return true;
+}
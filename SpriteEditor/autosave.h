@@ -0,0 +1,176 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <QObject>
+#include <QString>
+#include <QFile>
+#include <QVector>
+#include <QHash>
+#include <QTimer>
+#include <QFutureWatcher>
+#include "frame.h"
+
+/**
+ * Saves the frames in the background every so often, so a crash loses at most
+ * the last few seconds of drawing, and recovers them again.
+ *
+ * Autosaves go next to the project, or in the app data folder until it has been
+ * saved, as two files:
+ *
+ *   base     <project>.autosave, a whole project in the usual format. Right after
+ *            the project is opened or saved the project file itself is the base.
+ *   journal  <project>.journal, a log of what changed since the base:
+ *            "SSPJ", quint16 version, quint16 reserved, quint64 fingerprint of
+ *            the base, the base's file name, then entries of quint32 type,
+ *            quint32 size, quint64 checksum and the entry:
+ *              CHUNK_ENTRY   a frame chunk, the same as in a project file
+ *              FRAMES_ENTRY  quint32 width, quint32 height, quint32 frame count
+ *                            then per frame quint8 IN_BASE and quint32 the
+ *                            frame's index in the base, or quint8 IN_JOURNAL
+ *                            and quint64 the offset of the CHUNK_ENTRY holding it
+ *
+ * Each autosave appends the chunks of the frames that changed since the last,
+ * and then the frame list, so it costs about as much as what was drawn. Once the
+ * journal outgrows the base, the next autosave writes a new base and starts an
+ * empty journal instead.
+ *
+ * Frames are copied on the GUI thread, which only copies references to their
+ * tiles, and everything else happens on a worker thread. The base and the
+ * journal header are written to temporary files and moved into place, and
+ * recovery stops at the first journal entry that doesn't match its checksum, so
+ * a crash at any point recovers the last complete autosave.
+ */
+class Autosave : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int INTERVAL = 30*1000;
+    static const quint16 VERSION = 1;
+    static const quint32 CHUNK_ENTRY = 0;
+    static const quint32 FRAMES_ENTRY = 1;
+    static const quint8 IN_BASE = 0;
+    static const quint8 IN_JOURNAL = 1;
+
+    // Journals are only compacted once they're at least this big, as well as
+    // bigger than the base
+    static const qint64 COMPACT_SIZE = 1 << 20;
+
+    explicit Autosave(QObject* parent = nullptr);
+    ~Autosave();
+
+    /**
+     *  The frames to autosave, which must outlive the autosave or be replaced.
+     */
+    void setFrames(const QVector<Frame>* frames);
+
+    /**
+     *  Autosaves from now on go next to fileName, an empty name for a project
+     *  that hasn't been saved. Nothing is taken to be saved yet, see markSaved().
+     */
+    void setProjectFile(const QString& fileName);
+
+    /**
+     *  Takes saved to be the frames in the project file, in order, as they are
+     *  right after it's opened or saved.
+     */
+    void markSaved(const QVector<Frame>& saved);
+
+    /**
+     *  Returns true if there's an autosave of the current project to recover.
+     */
+    bool hasRecovery() const;
+
+    /**
+     *  Loads the last autosave of the current project into frames. Returns false
+     *  and sets error, leaving frames alone, if there's nothing usable.
+     */
+    bool recover(QVector<Frame>& frames, QString* error = nullptr);
+
+    /**
+     *  Deletes the autosave of the current project, once it's been saved for real.
+     */
+    void discard();
+
+    /**
+     *  Waits for an autosave that's being written to be done.
+     */
+    void waitForFinished();
+
+public slots:
+    /**
+     *  Starts autosaving the frames that changed since the last time, unless an
+     *  autosave is still being written or nothing changed.
+     */
+    void save();
+
+private slots:
+    void finishSave();
+
+private:
+    struct Location
+    {
+        quint8 place;
+        // Frame index in the base, or chunk entry offset in the journal
+        quint64 position;
+    };
+
+    // What a worker needs to write one autosave
+    struct Job
+    {
+        QVector<Frame> frames;
+        QHash<quint64, Location> savedRevisions;
+        QString baseName;
+        QString autosaveName;
+        QString journalName;
+        quint64 baseFingerprint;
+        qint64 baseSize;
+        qint64 journalSize;
+        bool compact;
+        int generation;
+    };
+
+    struct Result
+    {
+        bool succeeded;
+        QString error;
+        QHash<quint64, Location> savedRevisions;
+        QVector<quint64> revisions;
+        QString baseName;
+        quint64 baseFingerprint;
+        qint64 baseSize;
+        qint64 journalSize;
+        int generation;
+    };
+
+    static Result write(Job job);
+    static bool startJournal(const QString& journalName, const QString& baseName, quint64 baseFingerprint,
+                             qint64* size, QString* error);
+    static bool appendEntry(QFile& journal, quint32 type, const QByteArray& entry);
+    static quint64 fingerprint(const QString& fileName, qint64* size = nullptr);
+
+    const QVector<Frame>* frames;
+    QTimer timer;
+    QFutureWatcher<Result> watcher;
+
+    QString projectName;
+    QString autosaveName;
+    QString journalName;
+
+    // Where each frame revision already is, and the frames of the last autosave
+    QHash<quint64, Location> savedRevisions;
+    QVector<quint64> savedFrames;
+    // The file the journal is a log of changes to, empty until there is one
+    QString baseName;
+    quint64 baseFingerprint;
+    qint64 baseSize;
+    // Where the next journal entry goes, 0 if there's no journal yet
+    qint64 journalSize;
+
+    // Counts changes of project, so an autosave that finishes after is ignored
+    int generation;
+
+    void reset();
+};
+
+#endif // AUTOSAVE_H
@@ -0,0 +1,268 @@
+#include "batchexport.h"
+#include "exporter.h"
+#include "projectfile.h"
+#include <QCommandLineParser>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QFuture>
+#include <QHash>
+#include <QList>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <cstdio>
+#include <cstring>
+
+bool BatchExport::isRequested(int argc, char* argv[])
+{
+    // Checked before there's an application to parse the arguments with, since that
+    // decides which kind of application it is
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-e") == 0 || std::strcmp(argv[i], "--export") == 0
+                || std::strncmp(argv[i], "--export=", 9) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int BatchExport::run(const QStringList& arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Exports sprite projects without opening the editor.");
+    parser.addHelpOption();
+
+    QCommandLineOption exportOption(QStringList() << "e" << "export",
+            "What to export, any of gif, sheet, atlas, atlas-xml and png, separated by commas.", "formats");
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+            "The folder to export into, instead of next to each project.", "folder");
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs",
+            "How many projects to export at once, one per core by default.", "count");
+    QCommandLineOption columnsOption("columns",
+            "Frames per row of sprite sheets, about square by default.", "count", "0");
+    QCommandLineOption delayOption("delay",
+            "Hundredths of a second each GIF frame is shown for.", "hundredths",
+            QString::number(Exporter::DEFAULT_DELAY));
+
+    parser.addOption(exportOption);
+    parser.addOption(outputOption);
+    parser.addOption(jobsOption);
+    parser.addOption(columnsOption);
+    parser.addOption(delayOption);
+    parser.addPositionalArgument("projects", "Project files, or folders of them, to export.", "projects...");
+
+    // Exits with the usage for --help and unknown options
+    parser.process(arguments);
+
+    Options options;
+    options.gif = false;
+    options.sheet = false;
+    options.atlas = false;
+    options.atlasXml = false;
+    options.sequence = false;
+
+    for (const QString& format : parser.value(exportOption).split(","))
+    {
+        QString name = format.trimmed().toLower();
+        if (name == "gif")
+        {
+            options.gif = true;
+        }
+        else if (name == "sheet")
+        {
+            options.sheet = true;
+        }
+        else if (name == "atlas")
+        {
+            options.atlas = true;
+        }
+        else if (name == "atlas-xml")
+        {
+            options.atlasXml = true;
+        }
+        else if (name == "png")
+        {
+            options.sequence = true;
+        }
+        else
+        {
+            std::fprintf(stderr, "Unknown export format \"%s\", expected gif, sheet, atlas, atlas-xml or png.\n", qPrintable(name));
+            return 2;
+        }
+    }
+
+    bool columnsValid;
+    bool delayValid;
+    options.columns = parser.value(columnsOption).toInt(&columnsValid);
+    options.delay = parser.value(delayOption).toInt(&delayValid);
+    if (!columnsValid || options.columns < 0 || !delayValid || options.delay < 0 || options.delay > 0xffff)
+    {
+        std::fprintf(stderr, "--columns and --delay take a number from 0 up.\n");
+        return 2;
+    }
+
+    int jobs = QThread::idealThreadCount();
+    if (parser.isSet(jobsOption))
+    {
+        bool jobsValid;
+        jobs = parser.value(jobsOption).toInt(&jobsValid);
+        if (!jobsValid || jobs < 1)
+        {
+            std::fprintf(stderr, "--jobs takes a number from 1 up.\n");
+            return 2;
+        }
+    }
+
+    if (parser.isSet(outputOption))
+    {
+        options.outputFolder = parser.value(outputOption);
+        if (!QDir().mkpath(options.outputFolder))
+        {
+            std::fprintf(stderr, "Couldn't create %s.\n", qPrintable(options.outputFolder));
+            return 1;
+        }
+    }
+
+    // Each project's exports are named after it, and in an output folder keep the
+    // subfolder they were found in, so projects with the same name don't collide
+    QStringList projects;
+    QStringList baseNames;
+    for (const QString& argument : parser.positionalArguments())
+    {
+        QFileInfo info(argument);
+        if (info.isDir())
+        {
+            QDir folder(argument);
+            QDirIterator files(argument, QStringList() << "*.ssp", QDir::Files, QDirIterator::Subdirectories);
+            while (files.hasNext())
+            {
+                QString project = files.next();
+                projects.append(project);
+                baseNames.append(outputBaseName(project, folder.relativeFilePath(project), options));
+            }
+        }
+        else
+        {
+            projects.append(argument);
+            baseNames.append(outputBaseName(argument, info.fileName(), options));
+        }
+    }
+
+    if (projects.isEmpty())
+    {
+        std::fprintf(stderr, "No projects to export.\n");
+        return 2;
+    }
+
+    // Exports run at the same time, so two projects writing the same files would
+    // silently overwrite each other
+    QHash<QString, int> claimed;
+    for (int i = 0; i < projects.size(); i++)
+    {
+        QString key = QFileInfo(baseNames[i]).absoluteFilePath();
+        if (claimed.contains(key))
+        {
+            std::fprintf(stderr, "%s and %s would export to the same files.\n",
+                         qPrintable(projects[claimed[key]]), qPrintable(projects[i]));
+            return 2;
+        }
+
+        claimed.insert(key, i);
+    }
+
+    // Projects load their frames in parallel too, on the global pool, so this pool
+    // only bounds how many projects are open at once
+    QThreadPool pool;
+    pool.setMaxThreadCount(jobs);
+
+    QList<QFuture<QString>> results;
+    for (int i = 0; i < projects.size(); i++)
+    {
+        results.append(QtConcurrent::run(&pool, &BatchExport::exportProject, projects[i], baseNames[i], options));
+    }
+
+    // Reported in the order given, whichever finishes first
+    int failures = 0;
+    for (int i = 0; i < projects.size(); i++)
+    {
+        QString error = results[i].result();
+        if (error.isEmpty())
+        {
+            std::printf("Exported %s\n", qPrintable(projects[i]));
+        }
+        else
+        {
+            std::fprintf(stderr, "%s\n", qPrintable(error));
+            failures++;
+        }
+
+        std::fflush(stdout);
+    }
+
+    if (failures > 0)
+    {
+        std::fprintf(stderr, "%d of %d projects failed.\n", failures, projects.size());
+        return 1;
+    }
+
+    return 0;
+}
+
+QString BatchExport::outputBaseName(const QString& fileName, const QString& relativeName, const Options& options)
+{
+    if (options.outputFolder.isEmpty())
+    {
+        QFileInfo info(fileName);
+        return info.path() + "/" + info.completeBaseName();
+    }
+
+    QFileInfo relative(relativeName);
+    return QDir::cleanPath(options.outputFolder + "/" + relative.path() + "/" + relative.completeBaseName());
+}
+
+QString BatchExport::exportProject(const QString& fileName, const QString& baseName, const Options& options)
+{
+    QVector<Frame> frames;
+    QString error;
+    if (!ProjectFile::load(fileName, frames, &error))
+    {
+        return QString("Couldn't open %1: %2").arg(fileName, error);
+    }
+
+    QString folder = QFileInfo(baseName).path();
+    if (!QDir().mkpath(folder))
+    {
+        return QString("Couldn't create %1.").arg(folder);
+    }
+
+    if (options.gif && !Exporter::writeGif(baseName + ".gif", frames, options.delay, &error))
+    {
+        return error;
+    }
+
+    if (options.sheet && !Exporter::writeSpriteSheet(baseName + "_sheet.png", frames, options.columns, &error))
+    {
+        return error;
+    }
+
+    if (options.atlas && !Exporter::writeAtlas(baseName + "_atlas.json", frames, &error))
+    {
+        return error;
+    }
+
+    if (options.atlasXml && !Exporter::writeAtlas(baseName + "_atlas.xml", frames, &error))
+    {
+        return error;
+    }
+
+    if (options.sequence && !Exporter::writeImageSequence(baseName + ".png", frames, &error))
+    {
+        return error;
+    }
+
+    return QString();
+}
@@ -0,0 +1,62 @@
+#ifndef BATCHEXPORT_H
+#define BATCHEXPORT_H
+
+#include <QString>
+#include <QStringList>
+
+/**
+ * Exporting projects from the command line, without a window or a display, for
+ * build scripts:
+ *
+ *   SpriteEditor --export gif,sheet,atlas,png [--output folder] [--jobs count]
+ *                [--columns count] [--delay hundredths] projects...
+ *
+ * Projects can be .ssp files or folders, which are searched for .ssp files.
+ * Each project is exported next to itself, or into the output folder under the
+ * subfolder it was found in, as <name>.gif, <name>_sheet.png, <name>_atlas.png
+ * with <name>_atlas.json (or .xml for atlas-xml), and <name>_1.png,
+ * <name>_2.png... Several projects are exported at once, one per core unless
+ * --jobs says otherwise. Projects that would export to the same files are
+ * refused before anything is written.
+ */
+class BatchExport
+{
+public:
+    /**
+     *  Returns true if the command line asks for an export rather than the editor.
+     */
+    static bool isRequested(int argc, char* argv[]);
+
+    /**
+     *  Exports what the arguments ask for and returns the exit code, 0 if every
+     *  project was exported. Needs a QCoreApplication.
+     */
+    static int run(const QStringList& arguments);
+
+private:
+    struct Options
+    {
+        bool gif;
+        bool sheet;
+        bool atlas;
+        bool atlasXml;
+        bool sequence;
+        QString outputFolder;
+        int columns;
+        int delay;
+    };
+
+    /**
+     *  The path the project's exports are named after, without an extension.
+     *  relativeName is where the project was found under the folder given for
+     *  it, or just its name, and is kept under the output folder.
+     */
+    static QString outputBaseName(const QString& fileName, const QString& relativeName, const Options& options);
+
+    /**
+     *  Exports one project, returning what went wrong or an empty string.
+     */
+    static QString exportProject(const QString& fileName, const QString& baseName, const Options& options);
+};
+
+#endif // BATCHEXPORT_H
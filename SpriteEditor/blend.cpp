@@ -0,0 +1,110 @@
+#include "blend.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLEND_USE_SSE2
+#endif
+
+namespace
+{
+    // x/255 rounded to nearest, exact for every x up to 255*255
+    inline uint divideBy255(uint x)
+    {
+        x += 128;
+        return (x + (x >> 8)) >> 8;
+    }
+
+    void blendOverScalar(QRgb* destination, const QRgb* source, int count, int opacity)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            QRgb pixel = source[i];
+            uint alpha = divideBy255(qAlpha(pixel)*uint(opacity));
+
+            if (alpha == 0)
+            {
+                continue;
+            }
+
+            uint inverse = 255 - alpha;
+            QRgb under = destination[i];
+
+            destination[i] = qRgba(divideBy255(qRed(pixel)*alpha) + divideBy255(qRed(under)*inverse),
+                                   divideBy255(qGreen(pixel)*alpha) + divideBy255(qGreen(under)*inverse),
+                                   divideBy255(qBlue(pixel)*alpha) + divideBy255(qBlue(under)*inverse),
+                                   alpha + divideBy255(qAlpha(under)*inverse));
+        }
+    }
+
+#ifdef BLEND_USE_SSE2
+    inline __m128i divideBy255(__m128i x)
+    {
+        x = _mm_add_epi16(x, _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    }
+
+    // Blends two pixels, each channel widened to 16 bits
+    inline __m128i blendTwo(__m128i source, __m128i destination, __m128i opacity)
+    {
+        // Alpha is the top channel of each pixel
+        __m128i alpha = _mm_shufflelo_epi16(source, _MM_SHUFFLE(3, 3, 3, 3));
+        alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+        alpha = divideBy255(_mm_mullo_epi16(alpha, opacity));
+
+        // With the alpha channel forced to 255, premultiplying leaves alpha itself there
+        source = _mm_or_si128(source, _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0));
+        source = divideBy255(_mm_mullo_epi16(source, alpha));
+
+        __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+        destination = divideBy255(_mm_mullo_epi16(destination, inverse));
+
+        return _mm_add_epi16(source, destination);
+    }
+
+    int blendOverSse2(QRgb* destination, const QRgb* source, int count, int opacity)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i alphaMask = _mm_set1_epi32(int(0xff000000));
+        const __m128i opacityLanes = _mm_set1_epi16(short(opacity));
+
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i sourcePixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+
+            // Most of a sparse layer is fully transparent, and leaves the destination alone
+            __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(sourcePixels, alphaMask), zero);
+            if (_mm_movemask_epi8(transparent) == 0xffff)
+            {
+                continue;
+            }
+
+            __m128i destinationPixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(destination + i));
+
+            __m128i low = blendTwo(_mm_unpacklo_epi8(sourcePixels, zero), _mm_unpacklo_epi8(destinationPixels, zero), opacityLanes);
+            __m128i high = blendTwo(_mm_unpackhi_epi8(sourcePixels, zero), _mm_unpackhi_epi8(destinationPixels, zero), opacityLanes);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_packus_epi16(low, high));
+        }
+
+        return i;
+    }
+#endif
+}
+
+void blendOver(QRgb* destination, const QRgb* source, int count, int opacity)
+{
+    if (opacity <= 0)
+    {
+        return;
+    }
+
+    int done = 0;
+
+#ifdef BLEND_USE_SSE2
+    done = blendOverSse2(destination, source, count, opacity);
+#endif
+
+    // Whatever doesn't fill a whole vector
+    blendOverScalar(destination + done, source + done, count - done, opacity);
+}
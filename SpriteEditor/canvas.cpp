@@ -0,0 +1,578 @@
+#include "canvas.h"
+#include <QGuiApplication>
+#include <QScreen>
+#include <cstdlib>
+
+
+Canvas::Canvas(QWidget *parent)
+    : QWidget(parent)
+{
+    frame = nullptr;
+    frameIndex = -1;
+    history = nullptr;
+    isDrawingMirrored = false;
+    gridPixelSize = 0;
+    isFloatingSelection = false;
+    selectionDrag = NoDrag;
+    isStroking = false;
+    hasLastStrokePixel = false;
+
+    // Draw buffered stroke points at most once per screen refresh
+    qreal refreshRate = 60;
+    if (QGuiApplication::primaryScreen() != nullptr)
+    {
+        refreshRate = QGuiApplication::primaryScreen()->refreshRate();
+    }
+    refreshTimer = new QTimer(this);
+    refreshTimer->setSingleShot(true);
+    refreshTimer->setTimerType(Qt::PreciseTimer);
+    refreshTimer->setInterval(qMax(1, qRound(1000/refreshRate)));
+    QObject::connect(refreshTimer, &QTimer::timeout,
+                     this, &Canvas::flushStroke);
+}
+
+Canvas::~Canvas()
+{
+    // The frame and history belong to the model
+    frame = nullptr;
+    history = nullptr;
+}
+
+void Canvas::setFrame(Frame* frame, int index)
+{
+    // The old frame may already be gone, so a stroke in progress is cut short
+    refreshTimer->stop();
+    pendingStrokePixels.clear();
+    dirtyArea = QRect();
+    if (isStroking && history != nullptr)
+    {
+        history->endStroke();
+    }
+    isStroking = false;
+
+    this->frame = frame;
+    this->frameIndex = index;
+
+    // A move in progress belonged to the old frame. A floating selection lives in
+    // its frame, so the selection follows it when there is one.
+    selectionDrag = NoDrag;
+    if (frame != nullptr && frame->hasFloatingSelection())
+    {
+        selection = frame->getFloatingSelectionRect();
+    }
+    else if (frame != nullptr)
+    {
+        selection = selection.intersected(QRect(0, 0, frame->getWidth(), frame->getHeight()));
+    }
+
+    if (frame != nullptr)
+    {
+        setFixedSize(getCanvasRect().size());
+    }
+    update();
+}
+
+void Canvas::setHistory(EditHistory* history)
+{
+    this->history = history;
+}
+
+void Canvas::beginStroke(QColor color)
+{
+    endStroke();
+
+    isStroking = true;
+    strokeColor = color.rgba();
+    hasLastStrokePixel = false;
+
+    if (history != nullptr)
+    {
+        history->beginStroke(frameIndex, frame->getCurrentLayerIndex());
+    }
+}
+
+void Canvas::strokeTo(int x, int y)
+{
+    if (!isStroking)
+    {
+        return;
+    }
+
+    pendingStrokePixels.append(getPixelAtCoordinates(x, y));
+
+    if (!refreshTimer->isActive())
+    {
+        refreshTimer->start();
+    }
+}
+
+void Canvas::endStroke()
+{
+    if (!isStroking)
+    {
+        return;
+    }
+
+    // The last points must make it into the frame before the stroke is recorded
+    refreshTimer->stop();
+    flushStroke();
+    isStroking = false;
+
+    if (history != nullptr)
+    {
+        history->endStroke();
+    }
+}
+
+void Canvas::flushStroke()
+{
+    for (const QPoint& pixel : pendingStrokePixels)
+    {
+        if (!hasLastStrokePixel)
+        {
+            plotStrokePixel(pixel.x(), pixel.y());
+        }
+        else if (pixel != lastStrokePixel)
+        {
+            plotStrokeLine(lastStrokePixel, pixel);
+        }
+
+        lastStrokePixel = pixel;
+        hasLastStrokePixel = true;
+    }
+
+    pendingStrokePixels.clear();
+    repaintDirtyArea();
+}
+
+void Canvas::plotStrokePixel(int x, int y)
+{
+    if (!frame->contains(x, y))
+    {
+        return;
+    }
+
+    setPixel(x, y, strokeColor);
+
+    if (isDrawingMirrored)
+    {
+        //draws the pixel on the reflected vertical half
+        setPixel(frame->getWidth() - 1 - x, y, strokeColor);
+    }
+}
+
+void Canvas::plotStrokeLine(QPoint from, QPoint to)
+{
+    // Bresenham's line algorithm
+    int x = from.x();
+    int y = from.y();
+    int deltaX = std::abs(to.x() - x);
+    int deltaY = -std::abs(to.y() - y);
+    int stepX = x < to.x() ? 1 : -1;
+    int stepY = y < to.y() ? 1 : -1;
+    int error = deltaX + deltaY;
+
+    while (x != to.x() || y != to.y())
+    {
+        int doubledError = 2*error;
+
+        if (doubledError >= deltaY)
+        {
+            error += deltaY;
+            x += stepX;
+        }
+        if (doubledError <= deltaX)
+        {
+            error += deltaX;
+            y += stepY;
+        }
+
+        plotStrokePixel(x, y);
+    }
+}
+
+void Canvas::repaintDirtyArea()
+{
+    if (!dirtyArea.isEmpty())
+    {
+        update(dirtyArea);
+        dirtyArea = QRect();
+    }
+}
+
+Frame* Canvas::getFrame()
+{
+    return this->frame;
+}
+
+int Canvas::getCurrentPixelSize()
+{
+    return std::max(1, GRID_RESOLUTION/std::max(frame->getWidth(), frame->getHeight()));
+}
+
+QPoint Canvas::getPixelAtCoordinates(int x, int y)
+{
+    int pixelSize = getCurrentPixelSize();
+
+    // Round down, so points left of or above the grid don't land on pixel 0.
+    // Strokes that leave the grid need these to draw the right line back in.
+    int column = x < 0 ? (x - pixelSize + 1)/pixelSize : x/pixelSize;
+    int row = y < 0 ? (y - pixelSize + 1)/pixelSize : y/pixelSize;
+
+    return QPoint(column, row);
+}
+
+QRect Canvas::getPixelRect(int x, int y)
+{
+    int pixelSize = getCurrentPixelSize();
+
+    // One extra so the grid lines on the right and bottom edges are repainted too
+    return QRect(x*pixelSize, y*pixelSize, pixelSize + 1, pixelSize + 1);
+}
+
+QRect Canvas::getAreaRect(QRect area)
+{
+    int pixelSize = getCurrentPixelSize();
+
+    return QRect(area.left()*pixelSize, area.top()*pixelSize,
+                 area.width()*pixelSize + 1, area.height()*pixelSize + 1);
+}
+
+QRect Canvas::getCanvasRect()
+{
+    int pixelSize = getCurrentPixelSize();
+
+    return QRect(0, 0, frame->getWidth()*pixelSize + 1, frame->getHeight()*pixelSize + 1);
+}
+
+void Canvas::rebuildGridOverlay()
+{
+    int pixelSize = getCurrentPixelSize();
+    int gridWidth = frame->getWidth() * pixelSize;
+    int gridHeight = frame->getHeight() * pixelSize;
+
+    gridOverlay = QPixmap(gridWidth + 1, gridHeight + 1);
+    gridPixelSize = pixelSize;
+    gridOverlay.fill(Qt::transparent);
+
+    QPainter painter(&gridOverlay);
+    QPen pen(Qt::white);
+    painter.setPen(pen);
+
+    //display grid lines
+    for(int row = 0; row<=frame->getHeight(); row++)
+    {
+        painter.drawLine(0, row*pixelSize, gridWidth, row*pixelSize);
+    }
+    for(int column = 0; column<=frame->getWidth(); column++)
+    {
+        painter.drawLine(column*pixelSize, 0, column*pixelSize, gridHeight);
+    }
+}
+
+void Canvas::paintEvent(QPaintEvent *event)
+{
+    if (frame == nullptr)
+    {
+        return;
+    }
+
+    int pixelSize = getCurrentPixelSize();
+    bool showGrid = pixelSize >= MIN_GRID_PIXEL_SIZE;
+
+    if (!showGrid)
+    {
+        gridOverlay = QPixmap();
+    }
+    else if (gridOverlay.size() != getCanvasRect().size() || gridPixelSize != pixelSize)
+    {
+        rebuildGridOverlay();
+    }
+
+    // In a scroll area the event only covers what's visible, so that's all that gets drawn
+    QPainter painter(this);
+    QRect dirty = event->rect().intersected(getCanvasRect());
+
+    if (dirty.isEmpty())
+    {
+        return;
+    }
+
+    // Only scale up the sprite pixels that the dirty area touches
+    int firstColumn = dirty.left()/pixelSize;
+    int firstRow = dirty.top()/pixelSize;
+    int lastColumn = std::min(dirty.right()/pixelSize, frame->getWidth() - 1);
+    int lastRow = std::min(dirty.bottom()/pixelSize, frame->getHeight() - 1);
+
+    // Empty sprite pixels are transparent, so show them over gray
+    QRect dirtyPixels(firstColumn*pixelSize, firstRow*pixelSize,
+                      (lastColumn - firstColumn + 1)*pixelSize, (lastRow - firstRow + 1)*pixelSize);
+    painter.fillRect(dirtyPixels, QColor(160, 160, 160));
+
+    // Composited tiles are drawn straight from the frame's cache, without flattening it
+    // first. Tiles that were never drawn on are left showing the gray.
+    for (int tileRow = firstRow/Tile::SIZE; tileRow <= lastRow/Tile::SIZE; tileRow++)
+    {
+        for (int tileColumn = firstColumn/Tile::SIZE; tileColumn <= lastColumn/Tile::SIZE; tileColumn++)
+        {
+            const uchar* pixels = reinterpret_cast<const uchar*>(frame->getCompositeTilePixels(tileColumn, tileRow));
+
+            if (pixels == nullptr)
+            {
+                continue;
+            }
+
+            QImage tile(pixels, Tile::SIZE, Tile::SIZE, Tile::SIZE*sizeof(QRgb), QImage::Format_ARGB32_Premultiplied);
+
+            int tileX = tileColumn*Tile::SIZE;
+            int tileY = tileRow*Tile::SIZE;
+            int left = std::max(firstColumn, tileX);
+            int top = std::max(firstRow, tileY);
+            int right = std::min(lastColumn, tileX + Tile::SIZE - 1);
+            int bottom = std::min(lastRow, tileY + Tile::SIZE - 1);
+
+            QRect source(left - tileX, top - tileY, right - left + 1, bottom - top + 1);
+            QRect target(left*pixelSize, top*pixelSize, source.width()*pixelSize, source.height()*pixelSize);
+            painter.drawImage(target, tile, source);
+        }
+    }
+
+    if (showGrid)
+    {
+        painter.drawPixmap(dirty, gridOverlay, dirty);
+    }
+
+    if (!selection.isEmpty())
+    {
+        QRect outline = getAreaRect(selection).adjusted(0, 0, -1, -1);
+        painter.setPen(QPen(Qt::black, 1, Qt::DashLine));
+        painter.setBrush(Qt::NoBrush);
+        painter.drawRect(outline);
+    }
+}
+
+void Canvas::setPixel(int x, int y, QRgb rgb)
+{
+    QRgb before = frame->getPixelRgb(x, y);
+
+    if (before == rgb)
+    {
+        return;
+    }
+
+    frame->setPixelRgb(x, y, rgb);
+
+    if (history != nullptr)
+    {
+        history->recordPixel(x, y, before, rgb);
+    }
+
+    dirtyArea = dirtyArea.united(getPixelRect(x, y));
+}
+
+void Canvas::setDrawMirrored(bool checked)
+{
+
+    isDrawingMirrored = checked;
+}
+
+void Canvas::setFloatingSelection(bool floating)
+{
+    isFloatingSelection = floating;
+
+    if (!floating)
+    {
+        anchorSelection();
+    }
+}
+
+void Canvas::setSelection(QRect area)
+{
+    QRect repaint = getAreaRect(selection).united(getAreaRect(area));
+    selection = area;
+    update(repaint);
+}
+
+void Canvas::finishFrameEdit(const Frame& before, QRect area)
+{
+    if (history != nullptr)
+    {
+        history->recordFrameChange(frameIndex, before, *frame);
+    }
+
+    update(getAreaRect(area));
+}
+
+void Canvas::beginSelection(int x, int y)
+{
+    if (frame == nullptr)
+    {
+        return;
+    }
+
+    QPoint pixel = getPixelAtCoordinates(x, y);
+
+    if (selection.contains(pixel))
+    {
+        // The whole drag is one edit, the block only goes down when it's let go
+        selectionDrag = MoveDrag;
+        selectionDragBefore = *frame;
+        selectionDragStart = pixel;
+        selectionDragLast = pixel;
+        if (!frame->hasFloatingSelection())
+        {
+            frame->liftSelection(selection);
+        }
+        return;
+    }
+
+    anchorSelection();
+    selectionDrag = MarqueeDrag;
+    selectionDragStart = pixel;
+    setSelection(QRect(pixel, pixel).intersected(QRect(0, 0, frame->getWidth(), frame->getHeight())));
+}
+
+void Canvas::dragSelectionTo(int x, int y)
+{
+    QPoint pixel = getPixelAtCoordinates(x, y);
+
+    if (selectionDrag == MarqueeDrag)
+    {
+        QRect area = QRect(selectionDragStart, pixel).normalized();
+        setSelection(area.intersected(QRect(0, 0, frame->getWidth(), frame->getHeight())));
+    }
+    else if (selectionDrag == MoveDrag && pixel != selectionDragLast)
+    {
+        // Only the floating block's position changes, so this costs nothing per step
+        QPoint offset = pixel - selectionDragLast;
+        QRect before = selection;
+        frame->moveFloatingSelection(offset);
+        selection.translate(offset);
+        selectionDragLast = pixel;
+        update(getAreaRect(before).united(getAreaRect(selection)));
+    }
+}
+
+void Canvas::endSelection()
+{
+    if (selectionDrag == MoveDrag)
+    {
+        if (!isFloatingSelection)
+        {
+            frame->anchorFloatingSelection();
+        }
+
+        // A click that didn't move anything put the block straight back down
+        if (isFloatingSelection || selectionDragLast != selectionDragStart)
+        {
+            finishFrameEdit(selectionDragBefore, selection);
+        }
+        selectionDragBefore = Frame();
+    }
+
+    selectionDrag = NoDrag;
+}
+
+void Canvas::moveSelection(int dx, int dy)
+{
+    if (frame == nullptr || selection.isEmpty() || selectionDrag != NoDrag)
+    {
+        return;
+    }
+
+    Frame before = *frame;
+    QRect area = selection;
+
+    if (!frame->hasFloatingSelection())
+    {
+        frame->liftSelection(selection);
+    }
+    frame->moveFloatingSelection(QPoint(dx, dy));
+    selection.translate(dx, dy);
+
+    // One block copy, wherever the selection ends up
+    if (!isFloatingSelection)
+    {
+        frame->anchorFloatingSelection();
+    }
+
+    finishFrameEdit(before, area.united(selection));
+}
+
+void Canvas::copySelection()
+{
+    if (frame == nullptr || selection.isEmpty())
+    {
+        return;
+    }
+
+    clipboard = frame->copyArea(selection);
+}
+
+void Canvas::cutSelection()
+{
+    copySelection();
+    deleteSelection();
+}
+
+void Canvas::pasteSelection()
+{
+    if (frame == nullptr || clipboard.isNull())
+    {
+        return;
+    }
+
+    anchorSelection();
+
+    Frame before = *frame;
+    QPoint topLeft = selection.isEmpty() ? QPoint(0, 0) : selection.topLeft();
+    frame->floatImage(clipboard, topLeft);
+
+    if (!isFloatingSelection)
+    {
+        frame->anchorFloatingSelection();
+    }
+
+    QRect pasted(topLeft, clipboard.size());
+    setSelection(pasted);
+    finishFrameEdit(before, pasted);
+}
+
+void Canvas::deleteSelection()
+{
+    if (frame == nullptr || selection.isEmpty())
+    {
+        return;
+    }
+
+    Frame before = *frame;
+
+    if (frame->hasFloatingSelection())
+    {
+        frame->discardFloatingSelection();
+    }
+    else
+    {
+        frame->clearArea(selection);
+    }
+
+    finishFrameEdit(before, selection);
+}
+
+void Canvas::anchorSelection()
+{
+    if (frame == nullptr || !frame->hasFloatingSelection())
+    {
+        return;
+    }
+
+    Frame before = *frame;
+    frame->anchorFloatingSelection();
+    finishFrameEdit(before, selection);
+}
+
+void Canvas::clearSelection()
+{
+    anchorSelection();
+    setSelection(QRect());
+}
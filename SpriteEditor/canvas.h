@@ -0,0 +1,194 @@
+#ifndef CANVAS_H
+#define CANVAS_H
+#include <QWidget>
+#include <QPainter>
+#include <QPaintEvent>
+#include <QPixmap>
+#include <QColor>
+#include <QTimer>
+#include <QVector>
+#include "frame.h"
+#include "edithistory.h"
+
+/**
+ * The drawing area. There is only one of these, and it shows and edits
+ * whichever frame the model says is current. Sprites too big to fit are
+ * drawn one screen pixel per sprite pixel, and the canvas is meant to sit
+ * in a scroll area so only the visible part gets painted.
+ */
+class Canvas : public QWidget
+{
+    Q_OBJECT
+
+private:
+    Frame* frame;
+    int frameIndex;
+    EditHistory* history;
+    bool isDrawingMirrored;
+    const int GRID_RESOLUTION = 800;
+
+    // Below this many screen pixels per sprite pixel the grid would hide the drawing
+    const int MIN_GRID_PIXEL_SIZE = 4;
+
+    // Grid lines drawn once per resolution, then copied over whatever part of the canvas is repainted.
+    // Different resolutions can give the same canvas size, so the spacing it was drawn at is kept too.
+    QPixmap gridOverlay;
+    int gridPixelSize;
+
+    void rebuildGridOverlay();
+
+    /**
+     *  Returns the on screen area of the whole sprite, including the grid lines around it.
+     */
+    QRect getCanvasRect();
+
+    /**
+     *  Returns the on screen area of sprite pixel x, y, including the grid lines around it.
+     */
+    QRect getPixelRect(int x, int y);
+
+    // Input points of the stroke in progress are buffered here and drawn once per screen refresh
+    bool isStroking;
+    QRgb strokeColor;
+    QPoint lastStrokePixel;
+    bool hasLastStrokePixel;
+    QVector<QPoint> pendingStrokePixels;
+    QTimer* refreshTimer;
+
+    // Everything changed since the last repaint
+    QRect dirtyArea;
+
+    // The selected block in sprite pixels, empty when there is none
+    QRect selection;
+    bool isFloatingSelection;
+    enum SelectionDrag { NoDrag, MarqueeDrag, MoveDrag };
+    SelectionDrag selectionDrag;
+    QPoint selectionDragStart;
+    QPoint selectionDragLast;
+    Frame selectionDragBefore;
+    QImage clipboard;
+
+    /**
+     *  Returns the on screen area of a rectangle of sprite pixels, including the grid lines around it.
+     */
+    QRect getAreaRect(QRect area);
+
+    /**
+     *  Changes the selection and repaints its outline.
+     */
+    void setSelection(QRect area);
+
+    /**
+     *  Records the change of the frame from before for undo and repaints area,
+     *  in sprite pixels.
+     */
+    void finishFrameEdit(const Frame& before, QRect area);
+
+    /**
+     *  Changes one sprite pixel and records it for undo. It gets repainted by the
+     *  next repaintDirtyArea.
+     */
+    void setPixel(int x, int y, QRgb rgb);
+
+    /**
+     *  Colors the sprite pixel x, y and its mirror image, if it's on the frame.
+     */
+    void plotStrokePixel(int x, int y);
+
+    /**
+     *  Colors every sprite pixel on the line between from and to, except from itself.
+     */
+    void plotStrokeLine(QPoint from, QPoint to);
+
+    void repaintDirtyArea();
+
+private slots:
+    /**
+     *  Draws the buffered stroke points, joining them with lines, then repaints once.
+     */
+    void flushStroke();
+
+public:
+    explicit Canvas(QWidget *parent = nullptr);
+    ~Canvas() override;
+
+    /**
+     *  Shows frame, which is at index in the model, from now on. The frame belongs
+     *  to the model and must outlive its time on the canvas.
+     */
+    void setFrame(Frame* frame, int index);
+    Frame* getFrame();
+
+    /**
+     *  Where strokes get recorded for undo. The history belongs to the model.
+     */
+    void setHistory(EditHistory* history);
+
+    /**
+     *  Starts a pen or eraser stroke in color. Everything drawn until endStroke is
+     *  undone together.
+     */
+    void beginStroke(QColor color);
+
+    /**
+     *  Extends the stroke to x, y, which are in this widget's coordinates. The gap
+     *  from the previous point is filled in with a line.
+     */
+    void strokeTo(int x, int y);
+    void endStroke();
+
+    /**
+     *  The on screen length and height of one sprite pixel. Sprites are fit into
+     *  GRID_RESOLUTION screen pixels when they can be, bigger ones get one screen
+     *  pixel per sprite pixel.
+     */
+    int getCurrentPixelSize();
+
+    /**
+     *  Returns the sprite pixel that x, y (in this widget's coordinates) are inside of.
+     */
+    QPoint getPixelAtCoordinates(int x, int y);
+
+
+public slots:
+    void setDrawMirrored(bool checked);
+
+    /**
+     *  With floating selections on, moved and pasted pixels stay off the layer until
+     *  anchorSelection. Otherwise every move and paste is put down right away.
+     */
+    void setFloatingSelection(bool floating);
+
+    /**
+     *  Starts a selection drag at x, y, in this widget's coordinates. Inside the
+     *  current selection this moves it, anywhere else it starts a new one.
+     */
+    void beginSelection(int x, int y);
+    void dragSelectionTo(int x, int y);
+    void endSelection();
+
+    /**
+     *  Moves the selected block by dx, dy sprite pixels as one edit.
+     */
+    void moveSelection(int dx, int dy);
+
+    void copySelection();
+    void cutSelection();
+    void pasteSelection();
+    void deleteSelection();
+
+    /**
+     *  Puts a floating selection down on its layer. The selection stays.
+     */
+    void anchorSelection();
+
+    /**
+     *  Anchors and forgets the selection.
+     */
+    void clearSelection();
+
+protected:
+    void paintEvent (QPaintEvent *event) override;
+};
+
+#endif // CANVAS_H
@@ -0,0 +1,371 @@
+#include "edithistory.h"
+
+
+EditHistory::EditHistory(qint64 memoryLimit)
+{
+    this->memoryLimit = memoryLimit;
+    memoryUsed = 0;
+    isRecordingStroke = false;
+}
+
+qint64 EditHistory::Edit::cost() const
+{
+    qint64 bytes = sizeof(Edit) + changes.size()*sizeof(PixelChange);
+
+    // Counts every drawn tile, even though some are still shared with the live frames
+    for (const Frame& frame : framesBefore)
+    {
+        bytes += qint64(frame.getAllocatedTileCount())*sizeof(Tile);
+    }
+    for (const Frame& frame : framesAfter)
+    {
+        bytes += qint64(frame.getAllocatedTileCount())*sizeof(Tile);
+    }
+
+    return bytes;
+}
+
+void EditHistory::beginStroke(int frameIndex, int layerIndex)
+{
+    if (isRecordingStroke)
+    {
+        endStroke();
+    }
+
+    stroke = Edit();
+    stroke.type = Edit::Pixels;
+    stroke.frameIndex = frameIndex;
+    stroke.layerIndex = layerIndex;
+    strokePixels.clear();
+    isRecordingStroke = true;
+}
+
+void EditHistory::recordPixel(int x, int y, QRgb before, QRgb after)
+{
+    if (!isRecordingStroke)
+    {
+        return;
+    }
+
+    quint32 key = (quint32(y) << 16) | quint32(x);
+    QHash<quint32, int>::const_iterator existing = strokePixels.constFind(key);
+
+    if (existing != strokePixels.constEnd())
+    {
+        // Keep the color from before the stroke, only the result changes
+        stroke.changes[existing.value()].after = after;
+        return;
+    }
+
+    PixelChange change;
+    change.x = quint16(x);
+    change.y = quint16(y);
+    change.before = before;
+    change.after = after;
+
+    strokePixels.insert(key, stroke.changes.size());
+    stroke.changes.append(change);
+}
+
+void EditHistory::endStroke()
+{
+    if (!isRecordingStroke)
+    {
+        return;
+    }
+
+    isRecordingStroke = false;
+    strokePixels.clear();
+
+    if (!stroke.changes.isEmpty())
+    {
+        stroke.changes.squeeze();
+        push(stroke);
+    }
+
+    stroke = Edit();
+}
+
+void EditHistory::recordResolutionChange(QSize oldSize, QSize newSize, const QVector<Frame>& framesBefore, bool isScaled)
+{
+    endStroke();
+
+    Edit edit;
+    edit.type = Edit::Resolution;
+    edit.frameIndex = -1;
+    edit.oldSize = oldSize;
+    edit.newSize = newSize;
+    edit.isScaled = isScaled;
+    edit.framesBefore = framesBefore;
+
+    push(edit);
+}
+
+void EditHistory::recordFrameChange(int frameIndex, const Frame& before, const Frame& after)
+{
+    endStroke();
+
+    Edit edit;
+    edit.type = Edit::Snapshot;
+    edit.frameIndex = frameIndex;
+    edit.framesBefore.append(before);
+    edit.framesAfter.append(after);
+
+    push(edit);
+}
+
+void EditHistory::recordAllFramesChange(const QVector<Frame>& before, const QVector<Frame>& after)
+{
+    endStroke();
+
+    Edit edit;
+    edit.type = Edit::Snapshot;
+    edit.frameIndex = -1;
+    edit.framesBefore = before;
+    edit.framesAfter = after;
+
+    push(edit);
+}
+
+void EditHistory::push(const Edit& edit)
+{
+    // A new edit makes everything that was undone unreachable
+    for (const Edit& undone : redoStack)
+    {
+        memoryUsed -= undone.cost();
+    }
+    redoStack.clear();
+
+    undoStack.append(edit);
+    memoryUsed += edit.cost();
+
+    // Always keep the newest entry, even if it alone is over the limit
+    while (memoryUsed > memoryLimit && undoStack.size() > 1)
+    {
+        dropOldest();
+    }
+}
+
+void EditHistory::dropOldest()
+{
+    memoryUsed -= undoStack.first().cost();
+    undoStack.removeFirst();
+}
+
+bool EditHistory::canUndo() const
+{
+    return !undoStack.isEmpty();
+}
+
+bool EditHistory::canRedo() const
+{
+    return !redoStack.isEmpty();
+}
+
+int EditHistory::undo(QVector<Frame>& frames)
+{
+    endStroke();
+
+    if (undoStack.isEmpty())
+    {
+        return -1;
+    }
+
+    Edit edit = undoStack.takeLast();
+
+    if (edit.type == Edit::Pixels)
+    {
+        Frame& frame = frames[edit.frameIndex];
+
+        for (int i = edit.changes.size() - 1; i >= 0; i--)
+        {
+            const PixelChange& change = edit.changes.at(i);
+            frame.setLayerPixelRgb(edit.layerIndex, change.x, change.y, change.before);
+        }
+    }
+    else if (edit.type == Edit::Snapshot && edit.frameIndex >= 0)
+    {
+        frames[edit.frameIndex] = edit.framesBefore.first();
+    }
+    else
+    {
+        frames = edit.framesBefore;
+    }
+
+    redoStack.append(edit);
+    return edit.frameIndex;
+}
+
+int EditHistory::redo(QVector<Frame>& frames)
+{
+    endStroke();
+
+    if (redoStack.isEmpty())
+    {
+        return -1;
+    }
+
+    Edit edit = redoStack.takeLast();
+
+    if (edit.type == Edit::Pixels)
+    {
+        Frame& frame = frames[edit.frameIndex];
+
+        for (const PixelChange& change : edit.changes)
+        {
+            frame.setLayerPixelRgb(edit.layerIndex, change.x, change.y, change.after);
+        }
+    }
+    else if (edit.type == Edit::Snapshot)
+    {
+        if (edit.frameIndex >= 0)
+        {
+            frames[edit.frameIndex] = edit.framesAfter.first();
+        }
+        else
+        {
+            frames = edit.framesAfter;
+        }
+    }
+    else
+    {
+        // The frames are back to how they were, so changing them again gives the same result
+        for (Frame& frame : frames)
+        {
+            if (edit.isScaled)
+            {
+                frame.changeResolution(edit.newSize.width(), edit.newSize.height());
+            }
+            else
+            {
+                frame.resize(edit.newSize.width(), edit.newSize.height());
+            }
+        }
+    }
+
+    undoStack.append(edit);
+    return edit.frameIndex;
+}
+
+void EditHistory::setMemoryLimit(qint64 bytes)
+{
+    memoryLimit = bytes;
+
+    while (memoryUsed > memoryLimit && undoStack.size() > 1)
+    {
+        dropOldest();
+    }
+}
+
+qint64 EditHistory::getMemoryUsed() const
+{
+    return memoryUsed;
+}
+
+void EditHistory::clear()
+{
+    isRecordingStroke = false;
+    stroke = Edit();
+    strokePixels.clear();
+    undoStack.clear();
+    redoStack.clear();
+    memoryUsed = 0;
+}
+
+void EditHistory::frameInserted(int index)
+{
+    endStroke();
+
+    // Undoing a change to every frame would leave the new frame out (or at the
+    // wrong size), so it and everything before it can no longer be undone
+    for (int i = undoStack.size() - 1; i >= 0; i--)
+    {
+        if (undoStack.at(i).frameIndex < 0)
+        {
+            for (int dropped = 0; dropped <= i; dropped++)
+            {
+                dropOldest();
+            }
+            break;
+        }
+    }
+
+    for (const Edit& undone : redoStack)
+    {
+        memoryUsed -= undone.cost();
+    }
+    redoStack.clear();
+
+    for (Edit& edit : undoStack)
+    {
+        if (edit.frameIndex >= index)
+        {
+            edit.frameIndex++;
+        }
+    }
+}
+
+void EditHistory::frameRemoved(int index)
+{
+    endStroke();
+
+    QList<Edit>* stacks[] = { &undoStack, &redoStack };
+
+    for (QList<Edit>* stack : stacks)
+    {
+        for (int i = stack->size() - 1; i >= 0; i--)
+        {
+            Edit& edit = (*stack)[i];
+
+            if (edit.frameIndex < 0)
+            {
+                memoryUsed -= edit.cost();
+                edit.framesBefore.removeAt(index);
+                if (!edit.framesAfter.isEmpty())
+                {
+                    edit.framesAfter.removeAt(index);
+                }
+                memoryUsed += edit.cost();
+            }
+            else if (edit.frameIndex == index)
+            {
+                memoryUsed -= edit.cost();
+                stack->removeAt(i);
+            }
+            else if (edit.frameIndex > index)
+            {
+                edit.frameIndex--;
+            }
+        }
+    }
+}
+
+void EditHistory::framesSwapped(int first, int second)
+{
+    endStroke();
+
+    QList<Edit>* stacks[] = { &undoStack, &redoStack };
+
+    for (QList<Edit>* stack : stacks)
+    {
+        for (Edit& edit : *stack)
+        {
+            if (edit.frameIndex < 0)
+            {
+                std::swap(edit.framesBefore[first], edit.framesBefore[second]);
+                if (!edit.framesAfter.isEmpty())
+                {
+                    std::swap(edit.framesAfter[first], edit.framesAfter[second]);
+                }
+            }
+            else if (edit.frameIndex == first)
+            {
+                edit.frameIndex = second;
+            }
+            else if (edit.frameIndex == second)
+            {
+                edit.frameIndex = first;
+            }
+        }
+    }
+}
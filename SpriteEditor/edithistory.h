@@ -0,0 +1,130 @@
+#ifndef EDITHISTORY_H
+#define EDITHISTORY_H
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include <QSize>
+#include "frame.h"
+
+/**
+ * Undo and redo for drawing.
+ *
+ * A pen or eraser stroke becomes one entry listing only the pixels it changed,
+ * with their colors before and after, so undoing it costs the size of the stroke
+ * and not the size of the frame. Resolution changes, layer changes and fills keep
+ * the frames from before (and except for resolution, after) the change, which only
+ * hold on to tiles and copy no pixels.
+ *
+ * Once the entries use more than the memory limit, the oldest ones are dropped.
+ */
+class EditHistory
+{
+    struct PixelChange
+    {
+        quint16 x, y;
+        QRgb before, after;
+    };
+
+    struct Edit
+    {
+        enum Type { Pixels, Resolution, Snapshot };
+
+        Type type;
+
+        // -1 for entries that cover every frame
+        int frameIndex;
+
+        // For Pixels
+        int layerIndex;
+        QVector<PixelChange> changes;
+
+        // For Resolution
+        QSize oldSize;
+        QSize newSize;
+        bool isScaled;
+
+        // For Resolution and Snapshot, every frame or just frameIndex
+        QVector<Frame> framesBefore;
+        // For Snapshot
+        QVector<Frame> framesAfter;
+
+        qint64 cost() const;
+    };
+
+private:
+    QList<Edit> undoStack;
+    QList<Edit> redoStack;
+    qint64 memoryUsed;
+    qint64 memoryLimit;
+
+    // The stroke being drawn, and where each of its pixels is in the stroke's change list
+    bool isRecordingStroke;
+    Edit stroke;
+    QHash<quint32, int> strokePixels;
+
+    void push(const Edit& edit);
+    void dropOldest();
+
+public:
+    EditHistory(qint64 memoryLimit = 64*1024*1024);
+
+    /**
+     *  Starts collecting pixel changes to layerIndex of frameIndex into a single entry.
+     */
+    void beginStroke(int frameIndex, int layerIndex);
+
+    /**
+     *  Notes that pixel x, y of the stroke's frame went from before to after.
+     *  Touching the same pixel again only updates its after color.
+     */
+    void recordPixel(int x, int y, QRgb before, QRgb after);
+
+    /**
+     *  Pushes the stroke onto the undo stack, unless it changed nothing.
+     */
+    void endStroke();
+
+    /**
+     *  Records that every frame went from oldSize to newSize. framesBefore are
+     *  the frames as they were before the change. isScaled tells whether the
+     *  drawing was scaled with Frame::changeResolution or cropped with Frame::resize.
+     */
+    void recordResolutionChange(QSize oldSize, QSize newSize, const QVector<Frame>& framesBefore, bool isScaled = true);
+
+    /**
+     *  Records that frameIndex went from before to after, for changes like layer
+     *  edits and fills that are too big to list pixel by pixel.
+     */
+    void recordFrameChange(int frameIndex, const Frame& before, const Frame& after);
+
+    /**
+     *  Records that every frame went from before to after.
+     */
+    void recordAllFramesChange(const QVector<Frame>& before, const QVector<Frame>& after);
+
+    bool canUndo() const;
+    bool canRedo() const;
+
+    /**
+     *  Undoes the newest entry on frames and returns the index of the frame it
+     *  changed, or -1 for a change to every frame.
+     */
+    int undo(QVector<Frame>& frames);
+
+    /**
+     *  Redoes the last undone entry on frames and returns the index of the frame
+     *  it changed, or -1 for a change to every frame.
+     */
+    int redo(QVector<Frame>& frames);
+
+    void setMemoryLimit(qint64 bytes);
+    qint64 getMemoryUsed() const;
+    void clear();
+
+    // Keep entries pointing at the right frames when the frame list changes
+    void frameInserted(int index);
+    void frameRemoved(int index);
+    void framesSwapped(int first, int second);
+};
+
+#endif // EDITHISTORY_H
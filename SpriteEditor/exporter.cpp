@@ -0,0 +1,592 @@
+#include "exporter.h"
+#include "atlas.h"
+#include "gif.h"
+#include <QFileInfo>
+#include <QFuture>
+#include <QHash>
+#include <QImageWriter>
+#include <QSaveFile>
+#include <QSet>
+#include <QThreadPool>
+#include <QThreadStorage>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+const int Exporter::DEFAULT_DELAY;
+
+namespace
+{
+    void setError(QString* error, const QString& message)
+    {
+        if (error != nullptr)
+        {
+            *error = message;
+        }
+    }
+
+    // gif.h wants RGBA byte order, one byte per channel, not premultiplied
+    QImage flattenForGif(const Frame& frame)
+    {
+        return frame.toImage().convertToFormat(QImage::Format_RGBA8888);
+    }
+
+    // Colors a GIF palette can hold besides the transparent one at index 0
+    const int EXACT_COLORS = 255;
+
+    // gif.h only looks at red, green and blue, so colors are compared on those
+    inline quint32 gifColor(const uchar* pixel)
+    {
+        return (quint32(pixel[0]) << 16) | (quint32(pixel[1]) << 8) | pixel[2];
+    }
+
+    // The different colors in an RGBA8888 image, stopping once there are too many to matter
+    QSet<quint32> collectColors(const QImage& image)
+    {
+        QSet<quint32> colors;
+        const uchar* pixel = image.constBits();
+        const uchar* end = pixel + qint64(image.width())*image.height()*4;
+
+        for (; pixel != end && colors.size() <= EXACT_COLORS; pixel += 4)
+        {
+            colors.insert(gifColor(pixel));
+        }
+
+        return colors;
+    }
+
+    /**
+     *  If all of the frames together use few enough colors, fills in a palette
+     *  with exactly those colors, as few bits deep as will hold them, and where
+     *  each color is in it. Otherwise returns false. Frames are flattened a
+     *  batch at a time and dropped once counted, and counting stops as soon as
+     *  there are too many colors. progress is asked whether to go on before
+     *  each batch, and canceled set if it says not to.
+     */
+    bool makeExactPalette(const QVector<Frame>& frames, int batchSize, const Exporter::Progress& progress,
+                          bool& canceled, GifPalette& palette, QHash<quint32, int>& indexes)
+    {
+        QSet<quint32> colors;
+        canceled = false;
+
+        for (int first = 0; first < frames.size(); first += batchSize)
+        {
+            if (progress && !progress(0))
+            {
+                canceled = true;
+                return false;
+            }
+
+            QVector<int> batch;
+            for (int i = first; i < frames.size() && i < first + batchSize; i++)
+            {
+                batch.append(i);
+            }
+
+            QVector<QSet<quint32>> frameColors(batch.size());
+            QSet<quint32>* frameColorData = frameColors.data();
+
+            QtConcurrent::blockingMap(batch, [&](int index)
+            {
+                frameColorData[index - first] = collectColors(flattenForGif(frames[index]));
+            });
+
+            for (const QSet<quint32>& frame : frameColors)
+            {
+                colors.unite(frame);
+                if (colors.size() > EXACT_COLORS)
+                {
+                    return false;
+                }
+            }
+        }
+
+        // Sorted so the same frames always give the same file
+        QList<quint32> sorted = colors.values();
+        std::sort(sorted.begin(), sorted.end());
+
+        std::memset(&palette, 0, sizeof(palette));
+        palette.bitDepth = 1;
+        while ((1 << palette.bitDepth) < sorted.size() + 1)
+        {
+            palette.bitDepth++;
+        }
+
+        for (int i = 0; i < sorted.size(); i++)
+        {
+            palette.r[i + 1] = uint8_t(sorted[i] >> 16);
+            palette.g[i + 1] = uint8_t(sorted[i] >> 8);
+            palette.b[i + 1] = uint8_t(sorted[i]);
+            indexes.insert(sorted[i], i + 1);
+        }
+
+        return true;
+    }
+
+    // Lets gif.h write through a QIODevice
+    size_t writeToDevice(void* device, const uint8_t* bytes, size_t count)
+    {
+        qint64 written = static_cast<QIODevice*>(device)->write(reinterpret_cast<const char*>(bytes), qint64(count));
+        return written < 0 ? 0 : size_t(written);
+    }
+
+    // An LZW dictionary for each pool thread, so frames encoded on it reuse one
+    // rather than setting up their own
+    struct LzwTable
+    {
+        GifLzwTable table;
+
+        LzwTable()
+        {
+            GifInitLzwTable(&table);
+        }
+
+        ~LzwTable()
+        {
+            GifFreeLzwTable(&table);
+        }
+    };
+
+    QThreadStorage<LzwTable*> lzwTables;
+
+    // The image descriptor and LZW data for the changed part of one quantized
+    // frame, as GifWriteFrame would write them
+    QByteArray encodeGifFrame(const QByteArray& changed, GifRect rect, const GifPalette& palette, uint32_t delay,
+                              bool localPalette, uint32_t disposal)
+    {
+        GifPalette framePalette = palette;
+        if (!lzwTables.hasLocalData())
+        {
+            lzwTables.setLocalData(new LzwTable);
+        }
+
+        GifOutput out = GifMemoryOutput();
+        GifWriteLzwImage(&out, reinterpret_cast<const uint8_t*>(changed.constData()), rect.left, rect.top,
+                         rect.width, rect.height, delay, &framePalette, localPalette, &lzwTables.localData()->table,
+                         disposal);
+
+        QByteArray bytes(reinterpret_cast<const char*>(out.data), int(out.size));
+        GIF_FREE(out.data);
+        return bytes;
+    }
+
+    // The smallest rectangle around the pixels whose colors differ, empty if none do
+    QRect differenceRect(const QImage& first, const QImage& second)
+    {
+        int left = first.width();
+        int right = -1;
+        int top = -1;
+        int bottom = -1;
+
+        for (int y = 0; y < first.height(); y++)
+        {
+            const uchar* firstLine = first.constScanLine(y);
+            const uchar* secondLine = second.constScanLine(y);
+            if (std::memcmp(firstLine, secondLine, first.width()*4) == 0)
+            {
+                continue;
+            }
+
+            for (int x = 0; x < first.width(); x++)
+            {
+                if (gifColor(firstLine + x*4) != gifColor(secondLine + x*4))
+                {
+                    left = std::min(left, x);
+                    right = std::max(right, x);
+                    top = top < 0 ? y : top;
+                    bottom = y;
+                }
+            }
+        }
+
+        return right < 0 ? QRect() : QRect(QPoint(left, top), QPoint(right, bottom));
+    }
+
+    // How each frame is written with the exact palette
+    struct ExactFrame
+    {
+        // The part of the frame that's written
+        QRect rect;
+        // What's on the canvas when this frame is drawn, null for nothing
+        QImage base;
+        // What happens to it once it's been shown, see kGifDisposeNone
+        uint32_t disposal;
+    };
+
+    /**
+     *  Works out which part of the next frame to write, and what to do with the
+     *  frame before it once it's been shown. A frame can be left in place for
+     *  the next to be drawn over, or undone, which is less to write when the
+     *  next frame is closer to what was there before, like something that
+     *  flickers on and off. The choice giving the next frame less to write is
+     *  taken.
+     */
+    ExactFrame planExactFrame(ExactFrame& previous, const QImage& previousImage, const QImage& image)
+    {
+        auto area = [](const QRect& rect)
+        {
+            return qint64(rect.width())*rect.height();
+        };
+
+        QRect kept = differenceRect(previousImage, image);
+        QRect undone = previous.base.isNull() ? image.rect() : differenceRect(previous.base, image);
+
+        ExactFrame next;
+        next.disposal = kGifDisposeNone;
+        if (area(undone) < area(kept))
+        {
+            previous.disposal = kGifDisposePrevious;
+            next.rect = undone;
+            next.base = previous.base;
+        }
+        else
+        {
+            previous.disposal = kGifDisposeNone;
+            next.rect = kept;
+            next.base = previousImage;
+        }
+
+        // A frame the same as what's under it still needs a pixel, left transparent
+        if (next.rect.isEmpty())
+        {
+            next.rect = QRect(0, 0, 1, 1);
+        }
+
+        return next;
+    }
+
+    /**
+     *  Encodes the planned part of a frame against the exact global palette.
+     *  Every color is in it, so each pixel is looked up rather than searched for,
+     *  and, as in GifThresholdImage, pixels the same as the ones under them are
+     *  left transparent.
+     */
+    QByteArray encodeExactGifFrame(const QImage& current, const ExactFrame& frame, const QHash<quint32, int>& indexes,
+                                   const GifPalette& palette, uint32_t delay)
+    {
+        const QImage& base = frame.base;
+        QRect rect = frame.rect;
+        QByteArray changed(rect.width()*rect.height()*4, 0);
+        uchar* out = reinterpret_cast<uchar*>(changed.data());
+
+        // Neighboring pixels are usually the same color, so the last lookup is kept
+        quint32 lookedUp = 0;
+        int index = -1;
+
+        for (int y = rect.top(); y <= rect.bottom(); y++)
+        {
+            const uchar* next = current.constScanLine(y) + rect.left()*4;
+            const uchar* last = base.isNull() ? nullptr : base.constScanLine(y) + rect.left()*4;
+
+            for (int x = 0; x < rect.width(); x++, out += 4, next += 4)
+            {
+                quint32 color = gifColor(next);
+                if (last != nullptr && gifColor(last + x*4) == color)
+                {
+                    out[3] = kGifTransIndex;
+                    continue;
+                }
+
+                if (index < 0 || color != lookedUp)
+                {
+                    lookedUp = color;
+                    index = indexes.value(color);
+                }
+
+                out[3] = uint8_t(index);
+            }
+        }
+
+        GifRect gifRect = { uint32_t(rect.left()), uint32_t(rect.top()), uint32_t(rect.width()),
+                            uint32_t(rect.height()) };
+        return encodeGifFrame(changed, gifRect, palette, delay, false, frame.disposal);
+    }
+}
+
+/*
+  quoted from https://github.com/ginsweater/gif-h/issues/3
+ */
+bool Exporter::writeGif(const QString& fileName, const QVector<Frame>& frames, int delay, QString* error,
+                        const Progress& progress)
+{
+    if (frames.isEmpty())
+    {
+        setError(error, "There are no frames to export.");
+        return false;
+    }
+
+    uint32_t width = (uint32_t)frames[0].getWidth();
+    uint32_t height = (uint32_t)frames[0].getHeight();
+
+    // Frames are flattened and encoded up to lookahead frames ahead of the one
+    // being written, which bounds how many are held in memory at once
+    int lookahead = std::max(2, 2*QThreadPool::globalInstance()->maxThreadCount());
+
+    // Pixel art rarely has more colors than fit in one palette. When it doesn't,
+    // the palette is written once as the global color table, with no searching
+    // for the closest colors and no color table in each frame.
+    GifPalette exactPalette;
+    QHash<quint32, int> exactIndexes;
+    bool canceled;
+    bool exact = makeExactPalette(frames, lookahead, progress, canceled, exactPalette, exactIndexes);
+
+    if (canceled)
+    {
+        setError(error, "Exporting was canceled.");
+        return false;
+    }
+
+    // Written through a QSaveFile like projects, so a GIF cut short by an error or
+    // a cancel never replaces one that was there
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        setError(error, QString("Couldn't create %1: %2").arg(fileName, file.errorString()));
+        return false;
+    }
+
+    GifWriter writer;
+    GifBeginOutput(&writer, GifFunctionOutput(writeToDevice, &file), width, height, (uint32_t)delay,
+                   exact ? &exactPalette : nullptr);
+
+    // Otherwise each frame's palette is built from the pixels that changed since
+    // the last frame as it was quantized, so palettes and quantizing have to go
+    // in order, the way GifWriteFrame does them, and only LZW encoding runs on
+    // the pool. The file comes out the same as writing the frames one at a time.
+    // With the exact palette quantizing doesn't change the colors, so whole
+    // frames are encoded on the pool, each once the next one has decided what
+    // becomes of it. Either way only the part of each frame that changed is
+    // written, and encoded frames are written in order.
+    QVector<QFuture<QImage>> flattened(frames.size());
+    int nextFlattened = 0;
+    QList<QFuture<QByteArray>> encoded;
+
+    auto writeEncoded = [&]()
+    {
+        QByteArray bytes = encoded.takeFirst().result();
+        GifPutBytes(&writer.out, reinterpret_cast<const uint8_t*>(bytes.constData()), (size_t)bytes.size());
+    };
+
+    auto encodeExact = [&](const QImage& image, const ExactFrame& frame)
+    {
+        encoded.append(QtConcurrent::run([=]()
+        {
+            return encodeExactGifFrame(image, frame, exactIndexes, exactPalette, (uint32_t)delay);
+        }));
+    };
+
+    // The exact frame waiting on the next one to plan its disposal
+    ExactFrame pending;
+    QImage pendingImage;
+
+    for (int i = 0; i < frames.size(); i++)
+    {
+        if (progress && !progress(i))
+        {
+            // Work still running reads the frames, so it has to finish first
+            for (int j = i; j < nextFlattened; j++)
+            {
+                flattened[j].waitForFinished();
+            }
+
+            for (QFuture<QByteArray>& frame : encoded)
+            {
+                frame.waitForFinished();
+            }
+
+            // A GIF cut short is no use to anyone
+            GifEnd(&writer);
+            file.cancelWriting();
+            setError(error, "Exporting was canceled.");
+            return false;
+        }
+
+        for (; nextFlattened < frames.size() && nextFlattened <= i + lookahead; nextFlattened++)
+        {
+            flattened[nextFlattened] = QtConcurrent::run(flattenForGif, frames[nextFlattened]);
+        }
+
+        QImage image = flattened[i].result();
+        flattened[i] = QFuture<QImage>();
+
+        if (exact)
+        {
+            if (i == 0)
+            {
+                pending.rect = image.rect();
+                pending.disposal = kGifDisposeNone;
+            }
+            else
+            {
+                ExactFrame next = planExactFrame(pending, pendingImage, image);
+                encodeExact(pendingImage, pending);
+                pending = next;
+            }
+
+            pendingImage = image;
+        }
+        else
+        {
+            // writer.oldImage holds the last frame as quantized, with palette indexes in alpha
+            const uint8_t* previous = i == 0 ? nullptr : writer.oldImage;
+            GifPalette palette;
+            GifMakePalette(previous, image.constBits(), width, height, 8, false, &palette);
+            GifThresholdImage(previous, image.constBits(), writer.oldImage, width, height, &palette);
+
+            GifRect rect = GifChangedRect(writer.oldImage, width, height);
+            QByteArray changed(int(rect.width*rect.height*4), 0);
+            GifCropImage(writer.oldImage, width, rect, reinterpret_cast<uint8_t*>(changed.data()));
+
+            encoded.append(QtConcurrent::run([=]()
+            {
+                return encodeGifFrame(changed, rect, palette, (uint32_t)delay, true, kGifDisposeNone);
+            }));
+        }
+
+        // Frames that are done are written as soon as they can be, and the rest
+        // are waited for before they pile up
+        while (!encoded.isEmpty() && (encoded.first().isFinished() || encoded.size() > lookahead))
+        {
+            writeEncoded();
+        }
+    }
+
+    if (exact)
+    {
+        encodeExact(pendingImage, pending);
+    }
+
+    while (!encoded.isEmpty())
+    {
+        writeEncoded();
+    }
+
+    if (!GifEnd(&writer) || !file.commit())
+    {
+        setError(error, QString("Couldn't write %1: %2").arg(fileName, file.errorString()));
+        return false;
+    }
+
+    return true;
+}
+
+QImage Exporter::makeSpriteSheet(const QVector<Frame>& frames, int columns)
+{
+    if (frames.isEmpty())
+    {
+        return QImage();
+    }
+
+    if (columns <= 0)
+    {
+        columns = int(std::ceil(std::sqrt(double(frames.size()))));
+    }
+
+    columns = std::min(columns, frames.size());
+    int rows = (frames.size() + columns - 1)/columns;
+    int width = frames[0].getWidth();
+    int height = frames[0].getHeight();
+
+    QImage sheet(columns*width, rows*height, QImage::Format_ARGB32_Premultiplied);
+    sheet.fill(Qt::transparent);
+
+    // Frames are the same format as the sheet, so they're copied in a row at a time
+    for (int i = 0; i < frames.size(); i++)
+    {
+        QImage image = frames[i].toImage();
+        int left = (i % columns)*width;
+        int top = (i/columns)*height;
+
+        for (int y = 0; y < height; y++)
+        {
+            std::memcpy(sheet.scanLine(top + y) + left*sizeof(QRgb), image.constScanLine(y), width*sizeof(QRgb));
+        }
+    }
+
+    return sheet;
+}
+
+bool Exporter::writeSpriteSheet(const QString& fileName, const QVector<Frame>& frames, int columns, QString* error)
+{
+    if (frames.isEmpty())
+    {
+        setError(error, "There are no frames to export.");
+        return false;
+    }
+
+    return writeImage(fileName, makeSpriteSheet(frames, columns), error);
+}
+
+bool Exporter::writeAtlas(const QString& fileName, const QVector<Frame>& frames, QString* error)
+{
+    if (frames.isEmpty())
+    {
+        setError(error, "There are no frames to export.");
+        return false;
+    }
+
+    QFileInfo info(fileName);
+    QString imageName = info.completeBaseName() + ".png";
+    Atlas atlas(frames);
+
+    if (!writeImage(info.path() + "/" + imageName, atlas.getImage(), error))
+    {
+        return false;
+    }
+
+    // The table refers to the image by a relative name, so the two can be moved together
+    QByteArray table = info.suffix().toLower() == "xml" ? atlas.toXml(imageName) : atlas.toJson(imageName);
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(table) != table.size() || !file.commit())
+    {
+        setError(error, QString("Couldn't write %1: %2").arg(fileName, file.errorString()));
+        return false;
+    }
+
+    return true;
+}
+
+bool Exporter::writeImageSequence(const QString& fileName, const QVector<Frame>& frames, QString* error,
+                                  const Progress& progress)
+{
+    if (frames.isEmpty())
+    {
+        setError(error, "There are no frames to export.");
+        return false;
+    }
+
+    QFileInfo info(fileName);
+    QString prefix = info.path() + "/" + info.completeBaseName() + "_";
+    int digits = QString::number(frames.size()).size();
+
+    for (int i = 0; i < frames.size(); i++)
+    {
+        if (progress && !progress(i))
+        {
+            setError(error, "Exporting was canceled.");
+            return false;
+        }
+
+        QString frameName = prefix + QString("%1").arg(i + 1, digits, 10, QChar('0')) + ".png";
+        if (!writeImage(frameName, frames[i].toImage(), error))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Exporter::writeImage(const QString& fileName, const QImage& image, QString* error)
+{
+    QImageWriter writer(fileName, "png");
+    if (!writer.write(image))
+    {
+        setError(error, QString("Couldn't write %1: %2").arg(fileName, writer.errorString()));
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,67 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <QString>
+#include <QVector>
+#include <QImage>
+#include "frame.h"
+#include "projectfile.h"
+
+/**
+ * Writing frames out as images for use outside the editor: an animated GIF, a
+ * sprite sheet with every frame in a grid, a packed texture atlas, or one PNG
+ * per frame.
+ *
+ * Nothing here needs a window, so the same exports run from the editor and from
+ * the command line, see BatchExport. Exports only read the frames, so they can
+ * run on a worker thread given a copy of them.
+ */
+class Exporter
+{
+public:
+    typedef ProjectFile::Progress Progress;
+
+    // Hundredths of a second each GIF frame is shown for
+    static const int DEFAULT_DELAY = 10;
+
+    /**
+     *  Writes frames to fileName as a looping GIF. Returns false and sets error
+     *  if the file can't be written or progress stops it, in which case no
+     *  file is left behind. Frames are flattened and compressed on the global
+     *  thread pool. Animations with 255 colors or fewer get one exact global
+     *  palette, otherwise each frame gets its own, and the file is the same as
+     *  writing the frames one at a time. Only the part of each frame that
+     *  changed is written.
+     */
+    static bool writeGif(const QString& fileName, const QVector<Frame>& frames, int delay = DEFAULT_DELAY,
+                         QString* error = nullptr, const Progress& progress = Progress());
+
+    /**
+     *  Lays frames out left to right, top to bottom, columns to a row. With no
+     *  columns given the sheet is about square. Returns a premultiplied ARGB32
+     *  image, transparent where there's no frame.
+     */
+    static QImage makeSpriteSheet(const QVector<Frame>& frames, int columns = 0);
+    static bool writeSpriteSheet(const QString& fileName, const QVector<Frame>& frames, int columns = 0,
+                                 QString* error = nullptr);
+
+    /**
+     *  Writes the frames packed into a texture atlas, see Atlas. The frame table
+     *  goes to fileName, as JSON or as XML if it ends in .xml, and the image next
+     *  to it with the same name and a .png extension.
+     */
+    static bool writeAtlas(const QString& fileName, const QVector<Frame>& frames, QString* error = nullptr);
+
+    /**
+     *  Writes each frame to its own PNG, numbered from 1 after the name of
+     *  fileName, so sprite.png gives sprite_1.png, sprite_2.png... padded to the
+     *  same number of digits.
+     */
+    static bool writeImageSequence(const QString& fileName, const QVector<Frame>& frames,
+                                   QString* error = nullptr, const Progress& progress = Progress());
+
+private:
+    static bool writeImage(const QString& fileName, const QImage& image, QString* error);
+};
+
+#endif // EXPORTER_H
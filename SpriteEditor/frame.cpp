@@ -1,317 +1,663 @@
 #include "frame.h"
+#include "blend.h"
+#include "projectfile.h"
+#include <QSet>
+#include <atomic>
+#include <cstring>
 
+const int Frame::MAX_SIZE;
 
-using namespace std;
-Frame::Frame(QWidget *parent, bool isDrawingMirroredChecked)
-    : QWidget(parent)
+namespace
 {
-    isDrawingMirrored = isDrawingMirroredChecked;
-    image= QImage(GRID_RESOLUTION,GRID_RESOLUTION,QImage::Format_RGB32);
+    // Frames are changed from worker threads when filling every frame at once
+    std::atomic<quint64> nextRevision(1);
+}
+
+Frame::Frame(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    tileColumns = (width + Tile::SIZE - 1)/Tile::SIZE;
+    tileRows = (height + Tile::SIZE - 1)/Tile::SIZE;
+    layers.append(Layer(width, height, "Layer 1"));
+    currentLayerIndex = 0;
+    floatingLayerIndex = -1;
+    chunkIndex = 0;
+    isDecoded = true;
+    revision = nextRevision++;
+}
 
-    image.fill(qRgba(160 , 160, 160, 10));
-    currentPixelSize= 25;
-    currentColor = Qt::gray;
-    isPixelSelected = false;
+Frame Frame::fromChunk(const QSharedPointer<ProjectSource>& source, int index, int width, int height)
+{
+    Frame frame(width, height);
+    frame.layers.clear();
+    frame.source = source;
+    frame.chunkIndex = index;
+    frame.isDecoded = false;
+    return frame;
 }
 
-Frame::Frame(const Frame& other, bool isDrawingMirroredChecked)
+void Frame::decode() const
 {
-    image = other.image.copy();
-    currentPixelSize = other.currentPixelSize;
-    currentXCoord = other.currentXCoord;
-    currentYCoord = other.currentYCoord;
-    currentColor = other.currentColor;
-    isDrawingMirrored = isDrawingMirroredChecked;
+    if (isDecoded)
+    {
+        return;
+    }
+
+    QVector<Layer> decoded;
+    int current = 0;
+
+    // The index was checked when the project was opened but the chunks weren't,
+    // so a damaged frame comes up blank rather than taking the others down with it
+    if (!source->decode(chunkIndex, width, height, decoded, current))
+    {
+        qWarning("Frame data in %s is corrupt", qPrintable(source->getFileName()));
+        decoded = QVector<Layer>() << Layer(width, height, "Layer 1");
+        current = 0;
+    }
 
+    layers = decoded;
+    currentLayerIndex = current;
+    isDecoded = true;
 }
 
-Frame& Frame::operator= (Frame other)
+void Frame::detachSource()
 {
-    swap(image, other.image);
-    swap(currentPixelSize, other.currentPixelSize);
-    swap(currentXCoord, other.currentXCoord);
-    swap(currentYCoord, other.currentYCoord);
-    swap(currentColor, other.currentColor);
-    return *this;
+    decode();
+    source.reset();
+    chunkIndex = 0;
+    revision = nextRevision++;
 }
 
-Frame::~Frame()
+bool Frame::isLoaded() const
 {
+    return isDecoded;
+}
+
+bool Frame::unload()
+{
+    if (!source)
+    {
+        return false;
+    }
 
+    layers.clear();
+    composite.clear();
+    isDecoded = false;
+    return true;
 }
 
-void Frame::setImage(QImage* image)
+bool Frame::pack()
 {
-    this->image = *image;
+    if (hasFloatingSelection())
+    {
+        return false;
+    }
+
+    if (!source)
+    {
+        QByteArray chunk = ProjectFile::encodeFrame(*this);
+        source = QSharedPointer<ProjectSource>(new ProjectSource(chunk));
+        chunkIndex = 0;
+    }
+
+    return unload();
 }
-QImage& Frame::getImage()
+
+QSharedPointer<ProjectSource> Frame::getSource() const
+{
+    return source;
+}
+
+int Frame::getChunkIndex() const
 {
-    return this->image;
+    return chunkIndex;
 }
 
-void Frame::setCurrentPixelSize(int newSize)
+quint64 Frame::getRevision() const
 {
-      this->currentPixelSize = newSize;
+    return revision;
 }
 
-int Frame::getCurrentPixelSize()
+void Frame::invalidateComposite()
 {
-    return this->currentPixelSize;
+    composite.clear();
 }
 
-Frame::PixelCoordinates Frame::getPixelAtCoordinates(int x, int y)
+void Frame::invalidateComposite(QRect area)
 {
-    int xStarting = (x/currentPixelSize)*currentPixelSize;
-    int xEnding = xStarting + currentPixelSize -1;
-    int yStarting = (y/currentPixelSize)*currentPixelSize;
-    int yEnding = yStarting + currentPixelSize -1;
+    area = area.intersected(QRect(0, 0, width, height));
 
-    PixelCoordinates result(xStarting, xEnding, yStarting, yEnding);
-    return result;
+    for (int tileRow = area.top()/Tile::SIZE; tileRow <= area.bottom()/Tile::SIZE; tileRow++)
+    {
+        for (int tileColumn = area.left()/Tile::SIZE; tileColumn <= area.right()/Tile::SIZE; tileColumn++)
+        {
+            composite.remove(tileRow*tileColumns + tileColumn);
+        }
+    }
 }
 
-void Frame::setIsPixelSelected(bool input)
+int Frame::getWidth() const
 {
-    this->isPixelSelected = input;
+    return width;
 }
 
-void Frame::setCurrentSelectedX(int input)
+int Frame::getHeight() const
 {
-    this->currentSelectedX = input;
+    return height;
 }
 
-void Frame::setCurrentSelectedY(int input)
+QSize Frame::getSize() const
 {
-    this->currentSelectedY = input;
+    return QSize(width, height);
 }
 
-void Frame::setSelectedColor(QColor input)
+int Frame::getTileColumns() const
 {
-    this->selectedColor = input;
+    return tileColumns;
 }
 
-bool Frame::getIsPixelSelected()
+int Frame::getTileRows() const
 {
-    return this->isPixelSelected;
+    return tileRows;
 }
 
-int Frame::getCurrentSelectedX()
+int Frame::getAllocatedTileCount() const
 {
-    return this->currentSelectedX;
+    int count = 0;
+
+    for (const Layer& layer : layers)
+    {
+        count += layer.getAllocatedTileCount();
+    }
+
+    return count;
 }
 
-int Frame::getCurrentSelectedY()
+int Frame::getLayerCount() const
 {
-    return this->currentSelectedY;
+    decode();
+    return layers.size();
 }
 
-QColor Frame::getSelectedColor()
+const Layer& Frame::getLayer(int index) const
 {
-    return this->selectedColor;
+    decode();
+    return layers.at(index);
 }
 
-void Frame::saveColor(int x, int y, QColor color)
+int Frame::getCurrentLayerIndex() const
 {
-    int xOffset = 12;
-    int yOffset = 26;
-    int xIndex = (x - xOffset)/currentPixelSize;
-    int yIndex = (y - yOffset)/currentPixelSize;
+    decode();
+    return currentLayerIndex;
 }
-void Frame::paintEvent(QPaintEvent *)
+
+void Frame::setCurrentLayerIndex(int index)
 {
-    // Account for offset of our draw area within the window
-    PixelCoordinates points = getPixelAtCoordinates(currentXCoord-10,currentYCoord-26);
+    decode();
+    anchorFloatingSelection();
+    if (index >= 0 && index < layers.size() && index != currentLayerIndex)
+    {
+        detachSource();
+        currentLayerIndex = index;
+    }
+}
 
-    QPainter painter(this);
-    QPainter imagePainter(&image);
-    QBrush brush(currentColor);
+void Frame::setLayers(const QVector<Layer>& layers, int currentLayerIndex)
+{
+    discardFloatingSelection();
+    source.reset();
+    isDecoded = true;
+    revision = nextRevision++;
+    this->layers = layers;
+    this->currentLayerIndex = std::max(0, std::min(currentLayerIndex, layers.size() - 1));
+    invalidateComposite();
+}
 
-    imagePainter.setBrush(brush);
-    QRect rectangle(points.xStarting, points.yStarting, currentPixelSize, currentPixelSize);
-    imagePainter.fillRect(rectangle,brush);
+void Frame::addLayer(QString name)
+{
+    detachSource();
+    anchorFloatingSelection();
+    currentLayerIndex++;
+    layers.insert(currentLayerIndex, Layer(width, height, name));
 
-    QPen pen(Qt::white);
-    painter.setPen(pen);
+    // A blank layer changes nothing on screen, so the composite stays valid
+}
 
-    if (isDrawingMirrored)
+void Frame::removeLayer(int index)
+{
+    decode();
+    if (layers.size() <= 1 || index < 0 || index >= layers.size())
     {
-        //819 is the middle of the frame
-        currentXCoord = 819 - currentXCoord;
-
-        PixelCoordinates points = getPixelAtCoordinates(currentXCoord-10,currentYCoord-26);
+        return;
+    }
 
-	//draws rectangle on reflected vertical half
-        rectangle = QRect(points.xStarting, points.yStarting, this->currentPixelSize,this->currentPixelSize);
-        imagePainter.setBrush(brush);
+    detachSource();
+    anchorFloatingSelection();
+    layers.removeAt(index);
+    if (currentLayerIndex >= index && currentLayerIndex > 0)
+    {
+        currentLayerIndex--;
+    }
+    invalidateComposite();
+}
 
-        imagePainter.fillRect(rectangle,brush);
+void Frame::moveLayer(int from, int to)
+{
+    decode();
+    if (from == to || from < 0 || to < 0 || from >= layers.size() || to >= layers.size())
+    {
+        return;
     }
 
-    rectangle= QRect(points.xStarting, points.yStarting, this->currentPixelSize,this->currentPixelSize);
-    imagePainter.setBrush(brush);
-    imagePainter.fillRect(rectangle,brush);
-    imagePainter.drawRect(rectangle);
+    detachSource();
+    anchorFloatingSelection();
+    Layer moved = layers.takeAt(from);
+    layers.insert(to, moved);
+    currentLayerIndex = to;
+    invalidateComposite();
+}
 
+void Frame::setLayerOpacity(int index, int opacity)
+{
+    detachSource();
+    layers[index].setOpacity(opacity);
+    invalidateComposite();
+}
 
-    painter.drawImage(QPoint(),image);
+void Frame::setLayerVisible(int index, bool visible)
+{
+    detachSource();
+    layers[index].setVisible(visible);
+    invalidateComposite();
+}
+
+const QRgb* Frame::getCompositeTilePixels(int tileColumn, int tileRow) const
+{
+    decode();
+    int index = tileRow*tileColumns + tileColumn;
+    QHash<int, QSharedDataPointer<Tile>>::const_iterator cached = composite.constFind(index);
 
-    //display grid lines
-    for(int row = 0; row<=(image.height()/this->getCurrentPixelSize()); row++)
+    if (cached != composite.constEnd())
     {
-        painter.drawLine(0, row*this->getCurrentPixelSize(), 800, row*this->getCurrentPixelSize());
+        return cached.value()->pixels;
     }
-    for(int column = 0; column<=(image.width()/this->getCurrentPixelSize()); column++)
+
+    QSharedDataPointer<Tile> tile;
+    QRect tileArea = QRect(tileColumn*Tile::SIZE, tileRow*Tile::SIZE, Tile::SIZE, Tile::SIZE)
+            .intersected(QRect(0, 0, width, height));
+
+    for (int layerIndex = 0; layerIndex < layers.size(); layerIndex++)
     {
-        painter.drawLine(column*this->getCurrentPixelSize(), 0, column*this->getCurrentPixelSize(), image.height());
+        const Layer& layer = layers.at(layerIndex);
+
+        if (!layer.isVisible() || layer.getOpacity() == 0)
+        {
+            continue;
+        }
+
+        const QRgb* pixels = layer.getTilePixels(tileColumn, tileRow);
+
+        // The floating selection shows in place of the pixels under it on the layer it
+        // was lifted from, the same as when it gets anchored
+        QRgb merged[Tile::SIZE*Tile::SIZE];
+        QRect floatingArea = getFloatingSelectionRect().intersected(tileArea);
+
+        if (layerIndex == floatingLayerIndex && !floatingArea.isEmpty())
+        {
+            if (pixels != nullptr)
+            {
+                std::memcpy(merged, pixels, sizeof(merged));
+            }
+            else
+            {
+                std::fill(merged, merged + Tile::SIZE*Tile::SIZE, qRgba(0, 0, 0, 0));
+            }
+
+            for (int row = floatingArea.top(); row <= floatingArea.bottom(); row++)
+            {
+                const QRgb* line = reinterpret_cast<const QRgb*>(floating.constScanLine(row - floatingPosition.y()));
+                std::memcpy(merged + (row - tileArea.top())*Tile::SIZE + floatingArea.left() - tileArea.left(),
+                            line + floatingArea.left() - floatingPosition.x(), floatingArea.width()*sizeof(QRgb));
+            }
+
+            pixels = merged;
+        }
+
+        if (pixels != nullptr)
+        {
+            if (!tile)
+            {
+                tile = Layer::createTile();
+            }
+
+            blendOver(tile->pixels, pixels, Tile::SIZE*Tile::SIZE, layer.getOpacity());
+        }
     }
 
-}
+    // Tiles no layer has drawn on stay out of the cache, so a big empty frame keeps costing nothing
+    if (!tile)
+    {
+        return nullptr;
+    }
 
-void Frame::drawPixel(int x, int y, QColor color) {
-    currentXCoord = x;
-    currentYCoord = y - 25;
-    currentColor = color;
-    update();
+    composite.insert(index, tile);
+    return composite.constFind(index).value()->pixels;
 }
 
-void Frame::changeResolution(int newPixelSize)
+QRgb Frame::getCompositePixelRgb(int x, int y) const
 {
+    const QRgb* pixels = getCompositeTilePixels(x/Tile::SIZE, y/Tile::SIZE);
 
-    if (newPixelSize > currentPixelSize)
+    if (pixels == nullptr)
     {
-        image.fill(qRgba(160 , 160, 160, 10));
-        currentColor = Qt::transparent;
+        return qRgba(0, 0, 0, 0);
     }
 
-    this->currentPixelSize = newPixelSize;
+    return qUnpremultiply(pixels[(y % Tile::SIZE)*Tile::SIZE + x % Tile::SIZE]);
+}
 
-    update();
+bool Frame::contains(int x, int y) const
+{
+    return x >= 0 && y >= 0 && x < width && y < height;
+}
 
+QColor Frame::getPixel(int x, int y) const
+{
+    return QColor::fromRgba(getPixelRgb(x, y));
 }
 
-void Frame::setDrawMirrored(bool checked)
+void Frame::setPixel(int x, int y, QColor color)
 {
+    setPixelRgb(x, y, color.rgba());
+}
 
-    isDrawingMirrored = checked;
+QRgb Frame::getPixelRgb(int x, int y) const
+{
+    return getLayerPixelRgb(currentLayerIndex, x, y);
 }
 
-Frame::PixelCoordinates::PixelCoordinates(int xStart, int xEnd, int yStart, int yEnd)
+void Frame::setPixelRgb(int x, int y, QRgb rgb)
 {
-    xStarting = xStart;
-    xEnding = xEnd;
-    yStarting = yStart;
-    yEnding = yEnd;
+    setLayerPixelRgb(currentLayerIndex, x, y, rgb);
 }
-void Frame::shiftPixel(int x, int y, QColor color)
+
+QRgb Frame::getLayerPixelRgb(int layer, int x, int y) const
 {
-    if(whichArrow == 0)
-    {
-        currentXCoord = x;
-        currentYCoord = y - currentPixelSize;
-       
-    }
-    if(whichArrow == 1)
+    decode();
+    return layers.at(layer).getPixelRgb(x, y);
+}
+
+void Frame::setLayerPixelRgb(int layer, int x, int y, QRgb rgb)
+{
+    if (getLayerPixelRgb(layer, x, y) == rgb)
     {
-        currentXCoord = x;
-        currentYCoord = y + currentPixelSize;
-       
+        return;
     }
-    if(whichArrow == 2)
+
+    detachSource();
+    layers[layer].setPixelRgb(x, y, rgb);
+
+    // Only the tile under the edit gets composited again
+    composite.remove((y/Tile::SIZE)*tileColumns + x/Tile::SIZE);
+}
+
+QRect Frame::floodFill(int x, int y, QRgb rgb)
+{
+    detachSource();
+    anchorFloatingSelection();
+    QRect changed = layers[currentLayerIndex].floodFill(x, y, rgb);
+
+    if (!changed.isEmpty())
     {
-        currentXCoord = x - currentPixelSize;
-        currentYCoord = y ;
-       
+        invalidateComposite(changed);
     }
-    if(whichArrow == 3)
+
+    return changed;
+}
+
+QImage Frame::copyArea(QRect area) const
+{
+    decode();
+    if (hasFloatingSelection() && area == getFloatingSelectionRect())
     {
-        currentXCoord = x+ currentPixelSize;
-        currentYCoord = y ;
-       
+        return floating;
     }
 
-     currentColor = color;
-     update();
+    return layers.at(currentLayerIndex).copyArea(area);
+}
 
+void Frame::clearArea(QRect area)
+{
+    detachSource();
+    layers[currentLayerIndex].clearArea(area);
+    invalidateComposite(area);
+}
 
+bool Frame::hasFloatingSelection() const
+{
+    return !floating.isNull();
 }
 
-void Frame::updateForLoad()
+QRect Frame::getFloatingSelectionRect() const
 {
-    // Account for offset of our draw area within the window
-    PixelCoordinates points = getPixelAtCoordinates(currentXCoord,currentYCoord);
+    if (floating.isNull())
+    {
+        return QRect();
+    }
 
+    return QRect(floatingPosition, floating.size());
+}
 
-    QPainter painter(this);
-    QPainter imagePainter(&image);
-    QBrush brush(currentColor);
+void Frame::liftSelection(QRect area)
+{
+    detachSource();
+    anchorFloatingSelection();
+
+    area = area.intersected(QRect(0, 0, width, height));
+    if (area.isEmpty())
+    {
+        return;
+    }
+
+    floating = layers.at(currentLayerIndex).copyArea(area);
+    floatingPosition = area.topLeft();
+    floatingLayerIndex = currentLayerIndex;
 
-    imagePainter.setBrush(brush);
-    QRect rectangle(points.xStarting, points.yStarting, currentPixelSize, currentPixelSize);
-    imagePainter.fillRect(rectangle,brush);
+    // The pixels now live in the floating selection, which covers the same area
+    layers[currentLayerIndex].clearArea(area);
+    invalidateComposite(area);
+}
 
-    QPen pen(Qt::white);
-    painter.setPen(pen);
+void Frame::floatImage(const QImage& image, QPoint topLeft)
+{
+    detachSource();
+    anchorFloatingSelection();
 
-    if (isDrawingMirrored)
+    floating = image.convertToFormat(QImage::Format_ARGB32);
+    floatingPosition = topLeft;
+    floatingLayerIndex = currentLayerIndex;
+    invalidateComposite(getFloatingSelectionRect());
+}
+
+void Frame::moveFloatingSelection(QPoint offset)
+{
+    if (!hasFloatingSelection())
     {
-        //819 is the middle of the frame
-        currentXCoord = 819 - currentXCoord;
+        return;
+    }
 
-        //441 is the center coord
-        //int mirroredXCoord = 0;
-        //int mirroredYCoord = 0;
+    // A floating selection is saved anchored wherever it is
+    revision = nextRevision++;
+    invalidateComposite(getFloatingSelectionRect());
+    floatingPosition += offset;
+    invalidateComposite(getFloatingSelectionRect());
+}
 
-        //if (currentXCoord <= 410)
-        //    currentXCoord = 819 - currentXCoord;
-        //else if (currentXCoord > 410)
-         //   currentXCoord = 819 - currentXCoord;
+void Frame::anchorFloatingSelection()
+{
+    if (!hasFloatingSelection())
+    {
+        return;
+    }
 
-        // 10 is the x offset and 26 is the y offset
-        PixelCoordinates points = getPixelAtCoordinates(currentXCoord-10,currentYCoord-26);
+    QImage anchored = floating;
+    discardFloatingSelection();
+    layers[floatingLayerIndex].pasteImage(floatingPosition, anchored);
+}
 
-        rectangle = QRect(points.xStarting, points.yStarting, this->currentPixelSize,this->currentPixelSize);
-        imagePainter.setBrush(brush);
+void Frame::discardFloatingSelection()
+{
+    if (!hasFloatingSelection())
+    {
+        return;
+    }
 
-        imagePainter.fillRect(rectangle,brush);
+    revision = nextRevision++;
+    invalidateComposite(getFloatingSelectionRect());
+    floating = QImage();
+    floatingLayerIndex = -1;
+}
+
+QImage Frame::toImage() const
+{
+    // Exporting reads every frame once, so frames that aren't loaded are decoded
+    // into a copy and stay unloaded
+    if (!isDecoded)
+    {
+        Frame decoded = *this;
+        decoded.decode();
+        return decoded.toImage();
     }
 
-    rectangle= QRect(points.xStarting, points.yStarting, this->currentPixelSize,this->currentPixelSize);
-    imagePainter.setBrush(brush);
-    imagePainter.fillRect(rectangle,brush);
-    imagePainter.drawRect(rectangle);
-    if(isPixelSelected)
+    QImage image(width, height, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    // Only tiles some layer has drawn on can show anything
+    QSet<int> drawnTiles;
+    for (const Layer& layer : layers)
     {
-        QRect rectanglePrevious;
-        if(whichArrow == 0)
+        for (int index : layer.getAllocatedTiles())
         {
-            rectanglePrevious = QRect(points.xStarting, points.yStarting+currentPixelSize, this->currentPixelSize,this->currentPixelSize);
+            drawnTiles.insert(index);
         }
-        if(whichArrow == 1)
+    }
+
+    QRect floatingArea = getFloatingSelectionRect().intersected(QRect(0, 0, width, height));
+    if (!floatingArea.isEmpty())
+    {
+        for (int tileRow = floatingArea.top()/Tile::SIZE; tileRow <= floatingArea.bottom()/Tile::SIZE; tileRow++)
         {
-            rectanglePrevious = QRect(points.xStarting, points.yStarting-currentPixelSize, this->currentPixelSize,this->currentPixelSize);
+            for (int tileColumn = floatingArea.left()/Tile::SIZE; tileColumn <= floatingArea.right()/Tile::SIZE; tileColumn++)
+            {
+                drawnTiles.insert(tileRow*tileColumns + tileColumn);
+            }
+        }
+    }
+
+    for (int index : drawnTiles)
+    {
+        int tileColumn = index % tileColumns;
+        int tileRow = index / tileColumns;
+        const QRgb* pixels = getCompositeTilePixels(tileColumn, tileRow);
 
+        if (pixels == nullptr)
+        {
+            continue;
         }
-        if(whichArrow == 2)
+
+        int left = tileColumn*Tile::SIZE;
+        int top = tileRow*Tile::SIZE;
+        int count = std::min(Tile::SIZE, width - left);
+        int rows = std::min(Tile::SIZE, height - top);
+
+        for (int row = 0; row < rows; row++)
         {
-            rectanglePrevious = QRect(points.xStarting+currentPixelSize, points.yStarting, this->currentPixelSize,this->currentPixelSize);
+            QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(top + row));
+            std::memcpy(line + left, pixels + row*Tile::SIZE, count*sizeof(QRgb));
         }
-        if(whichArrow == 3)
+    }
+
+    return image;
+}
+
+QImage Frame::toScaledImage(QSize size) const
+{
+    // Previews cycle through every frame, so frames that aren't loaded stay that way
+    if (!isDecoded)
+    {
+        Frame decoded = *this;
+        decoded.decode();
+        return decoded.toScaledImage(size);
+    }
+
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+
+    for (int y = 0; y < size.height(); y++)
+    {
+        QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        int sourceY = int(qint64(y)*height/size.height());
+
+        // Consecutive output pixels mostly come from the same tile
+        int lastTileColumn = -1;
+        const QRgb* tileLine = nullptr;
+
+        for (int x = 0; x < size.width(); x++)
         {
-            rectanglePrevious = QRect(points.xStarting-currentPixelSize, points.yStarting, this->currentPixelSize,this->currentPixelSize);
+            int sourceX = int(qint64(x)*width/size.width());
+            int tileColumn = sourceX/Tile::SIZE;
+
+            if (tileColumn != lastTileColumn)
+            {
+                const QRgb* pixels = getCompositeTilePixels(tileColumn, sourceY/Tile::SIZE);
+                tileLine = pixels == nullptr ? nullptr : pixels + (sourceY % Tile::SIZE)*Tile::SIZE;
+                lastTileColumn = tileColumn;
+            }
+
+            line[x] = tileLine == nullptr ? qRgba(0, 0, 0, 0) : tileLine[sourceX % Tile::SIZE];
         }
-        QBrush grayBrush(Qt::gray);
-        imagePainter.setBrush(grayBrush);
-        imagePainter.fillRect(rectanglePrevious,grayBrush);
     }
-    painter.drawImage(QPoint(),image);
 
-    //display grid lines
-    for(int row = 0; row<=(image.height()/this->getCurrentPixelSize()); row++)
+    return image;
+}
+
+void Frame::fromImage(const QImage& image)
+{
+    Layer layer(image.width(), image.height(), "Layer 1");
+    layer.fromImage(image);
+
+    *this = Frame(image.width(), image.height());
+    layers[0] = layer;
+}
+
+void Frame::changeResolution(int newWidth, int newHeight)
+{
+    detachSource();
+    anchorFloatingSelection();
+    for (Layer& layer : layers)
     {
-        painter.drawLine(0, row*this->getCurrentPixelSize(), 800, row*this->getCurrentPixelSize());
+        layer.changeResolution(newWidth, newHeight);
     }
-    for(int column = 0; column<=(image.width()/this->getCurrentPixelSize()); column++)
+
+    width = newWidth;
+    height = newHeight;
+    tileColumns = (width + Tile::SIZE - 1)/Tile::SIZE;
+    tileRows = (height + Tile::SIZE - 1)/Tile::SIZE;
+    invalidateComposite();
+}
+
+void Frame::resize(int newWidth, int newHeight)
+{
+    detachSource();
+    anchorFloatingSelection();
+    for (Layer& layer : layers)
     {
-        painter.drawLine(column*this->getCurrentPixelSize(), 0, column*this->getCurrentPixelSize(), image.height());
+        layer.resize(newWidth, newHeight);
     }
+
+    width = newWidth;
+    height = newHeight;
+    tileColumns = (width + Tile::SIZE - 1)/Tile::SIZE;
+    tileRows = (height + Tile::SIZE - 1)/Tile::SIZE;
+    invalidateComposite();
 }
@@ -1,95 +1,240 @@
 #ifndef FRAME_H
 #define FRAME_H
-#include <QMainWindow>
-#include <QPainter>
+#include <QImage>
 #include <QColor>
-#include <QRgba64>
-#include <QWidget>
-#include <algorithm>
-
-class Frame : public QWidget
+#include <QSize>
+#include <QRect>
+#include <QPoint>
+#include <QHash>
+#include <QVector>
+#include <QSharedDataPointer>
+#include <QSharedPointer>
+#include "layer.h"
+
+class ProjectSource;
+
+/**
+ * One animation frame: a stack of layers, at sprite resolution.
+ *
+ * Frames are plain values owned by the SpriteModel. Drawing goes to the current
+ * layer. What gets shown and exported is the composite of the visible layers,
+ * which is cached per tile and only recomposited for tiles that changed since,
+ * so showing a frame with many layers costs about as much as showing one. The
+ * Canvas widget is what puts a frame on screen.
+ *
+ * Frames opened from a project file start out encoded, and only decode their
+ * layers the first time something reads them. Until they're changed they can
+ * drop the decoded layers again with unload(), and changed frames can be
+ * encoded in memory and dropped with pack().
+ */
+class Frame
 {
-    Q_OBJECT
+private:
+    int width;
+    int height;
+    int tileColumns;
+    int tileRows;
+    // Filled in on first use for frames that start out encoded, see decode()
+    mutable QVector<Layer> layers;
+    mutable int currentLayerIndex;
+
+    // The encoded chunk the layers come from, kept until the frame changes
+    QSharedPointer<ProjectSource> source;
+    int chunkIndex;
+    mutable bool isDecoded;
+
+    // Changes whenever the contents do, copies share it until either changes
+    quint64 revision;
+
+    // Blended visible layers, premultiplied. Tiles missing from here haven't been
+    // composited since they last changed. Filled in by const reads, so one frame
+    // must not be read from two threads at once; copies are fine.
+    mutable QHash<int, QSharedDataPointer<Tile>> composite;
+
+    // Pixels picked up by a selection and not yet put down, shown in place of
+    // the pixels under them on the layer they came from. Null when nothing is floating.
+    QImage floating;
+    QPoint floatingPosition;
+    int floatingLayerIndex;
+
+    void invalidateComposite();
+    void invalidateComposite(QRect area);
+
+    void decode() const;
+
+    // Decodes the frame, forgets its chunk and takes a new revision, before
+    // anything changes it
+    void detachSource();
 
-    /*
-      contains the four coordinates of the pixel
-     */
-struct PixelCoordinates
-{
 public:
-    int xStarting, xEnding, yStarting, yEnding;
-    PixelCoordinates(int xStarting, int xEnding, int yStarting, int yEnding);
-};
+    static const int MAX_SIZE = 4096;
 
-private:
-    QImage image;
-    int currentPixelSize;
-    bool isDrawingMirrored;
-    const int GRID_RESOLUTION = 800;
-    QColor colorGrid[32][32];
+    Frame(int width = 32, int height = 32);
 
-    void saveColor(int x, int y, QColor color);
+    /**
+     *  Makes a width x height frame whose layers are decoded from chunk index of
+     *  source the first time they're needed.
+     */
+    static Frame fromChunk(const QSharedPointer<ProjectSource>& source, int index, int width, int height);
 
-public:
-    Frame(QWidget *parent = nullptr, bool isDrawingMirroredChecked = false);
-    Frame(const Frame &other, bool isDrawingMirroredChecked = false);
-    ~Frame() override;
-    Frame &operator= (Frame other);
-    void updateForLoad();
+    /**
+     *  Returns true if the layers are in memory rather than only in a project file.
+     */
+    bool isLoaded() const;
+
+    /**
+     *  Drops the decoded layers of a frame that hasn't changed since it was
+     *  opened, they'll be decoded again when next used. Returns false, leaving
+     *  the frame alone, if it has changed.
+     */
+    bool unload();
+
+    /**
+     *  Encodes the frame into a chunk, the same as it's saved in a project, and
+     *  drops the decoded layers. Sprites are mostly flat color, so that's a
+     *  fraction of their size. Returns false, leaving the frame alone, if a
+     *  selection is floating.
+     */
+    bool pack();
+
+    /**
+     *  Where the encoded chunk of a frame that hasn't changed since it was opened
+     *  or packed is. The source is null if it has changed.
+     */
+    QSharedPointer<ProjectSource> getSource() const;
+    int getChunkIndex() const;
+
+    /**
+     *  A number that's different after every change to the frame, and the same
+     *  for copies of it that haven't changed since, for telling what needs
+     *  saving again. Revisions are never reused, even across frames.
+     */
+    quint64 getRevision() const;
+
+    int getWidth() const;
+    int getHeight() const;
+    QSize getSize() const;
+    int getTileColumns() const;
+    int getTileRows() const;
+
+    /**
+     *  Returns how many layer tiles have been drawn on and take up memory. Frames
+     *  that aren't loaded take up none.
+     */
+    int getAllocatedTileCount() const;
+
+    int getLayerCount() const;
+    const Layer& getLayer(int index) const;
+    int getCurrentLayerIndex() const;
+    void setCurrentLayerIndex(int index);
 
+    /**
+     *  Replaces every layer at once, for loading. The layers must be the size of
+     *  the frame and there must be at least one.
+     */
+    void setLayers(const QVector<Layer>& layers, int currentLayerIndex);
 
-    // Theses 4 variablies are for moving pixels
-    bool isPixelSelected;
-    int currentSelectedX;
-    int currentSelectedY;
-    int currentXCoord;
-    int currentYCoord;
-    QColor currentColor;
-    int whichArrow; //direction of keypress
-    QColor selectedColor;
+    /**
+     *  Adds a blank layer above the current one and makes it current.
+     */
+    void addLayer(QString name);
 
+    /**
+     *  Removes the layer at index, unless it's the only one left.
+     */
+    void removeLayer(int index);
+    void moveLayer(int from, int to);
+    void setLayerOpacity(int index, int opacity);
+    void setLayerVisible(int index, bool visible);
 
-    QImage& getImage();
-    void setImage(QImage* image);
-    void setCurrentPixelSize(int newSize);
-    int getCurrentPixelSize();
-    void drawPixel(int x, int y, QColor color);
     /**
-     *  Returns an object with the boundaries of whatever pixel x, y are inside of.
+     *  Returns the composited Tile::SIZE x Tile::SIZE pixels of a tile, row by
+     *  row and premultiplied, or nullptr if no visible layer has anything there.
+     *  The pointer is good until the frame changes.
      */
-    PixelCoordinates getPixelAtCoordinates(int x, int y);
+    const QRgb* getCompositeTilePixels(int tileColumn, int tileRow) const;
 
+    /**
+     *  Returns the composited color of sprite pixel x, y, not premultiplied.
+     */
+    QRgb getCompositePixelRgb(int x, int y) const;
 
-public slots:
-  /*
-    adjusts the number of pixels shown in the grid where the length and height of the pixel is newPixelSize
-   */
-    void changeResolution(int newPixelSize);
-    void setDrawMirrored(bool checked);
+    /**
+     *  Returns true if x, y is a sprite pixel of this frame.
+     */
+    bool contains(int x, int y) const;
 
-    // These are for moving pixels
+    // Pixels of the current layer
+    QColor getPixel(int x, int y) const;
+    void setPixel(int x, int y, QColor color);
+    QRgb getPixelRgb(int x, int y) const;
+    void setPixelRgb(int x, int y, QRgb rgb);
 
+    QRgb getLayerPixelRgb(int layer, int x, int y) const;
+    void setLayerPixelRgb(int layer, int x, int y, QRgb rgb);
 
-    void setIsPixelSelected(bool input);
-    void setCurrentSelectedX(int input);
-    void setCurrentSelectedY(int input);
-    void setSelectedColor(QColor input);
+    /**
+     *  Flood fills the current layer from x, y with rgb, see Layer::floodFill.
+     *  Returns the bounding box of the pixels that changed.
+     */
+    QRect floodFill(int x, int y, QRgb rgb);
 
+    /**
+     *  Returns the pixels of the current layer inside area, or the floating
+     *  selection if area is exactly where it is.
+     */
+    QImage copyArea(QRect area) const;
 
-    bool getIsPixelSelected();
-    int getCurrentSelectedX();
-    int getCurrentSelectedY();
-    QColor getSelectedColor();
+    /**
+     *  Makes every pixel of the current layer inside area transparent.
+     */
+    void clearArea(QRect area);
 
     /*
-      the selected is moved in the direction the arrow key is pressed
+      the floating selection. Lifting a selection moves its pixels off the current layer so it can
+      be moved around for free, anchoring pastes them back wherever it ended up. Changing the
+      layers, the frame size or filling anchors it first.
+     */
+    bool hasFloatingSelection() const;
+    QRect getFloatingSelectionRect() const;
+    void liftSelection(QRect area);
+    void floatImage(const QImage& image, QPoint topLeft);
+    void moveFloatingSelection(QPoint offset);
+    void anchorFloatingSelection();
+    void discardFloatingSelection();
+
+    /**
+     *  Flattens the composite into a single premultiplied ARGB32 image the size
+     *  of the frame.
+     */
+    QImage toImage() const;
+
+    /**
+     *  Returns the composite scaled to size without smoothing, reading only the
+     *  pixels that end up in the result. Cheaper than toImage().scaled() for
+     *  previews of large frames.
      */
-    void shiftPixel(int x, int y, QColor color);
+    QImage toScaledImage(QSize size) const;
 
+    /**
+     *  Replaces the frame with a single layer holding the pixels of image,
+     *  resizing it to match.
+     */
+    void fromImage(const QImage& image);
 
+    /*
+      changes the sprite resolution of every layer. Going to a finer resolution keeps the drawing
+      by turning every old pixel into a block of new ones, going coarser clears the frame.
+     */
+    void changeResolution(int newWidth, int newHeight);
 
-protected:
-    void paintEvent (QPaintEvent *event) override;
+    /**
+     *  Changes the size of every layer without scaling. The drawing stays anchored to
+     *  the top left corner, anything past the new edges is cut off.
+     */
+    void resize(int newWidth, int newHeight);
 };
 
+Q_DECLARE_TYPEINFO(Frame, Q_MOVABLE_TYPE);
+
 #endif // FRAME_H
@@ -20,6 +20,7 @@
 // Create a GifWriter struct. Pass it to GifBegin() to initialize and write the header.
 // Pass subsequent frames to GifWriteFrame().
 // Finally, call GifEnd() to close the file handle and free memory.
+// To write somewhere other than a file, pass a GifOutput to GifBeginOutput() instead.
 //
 
 #ifndef gif_h
@@ -32,8 +33,8 @@
 // Define these macros to hook into a custom memory allocator.
 // TEMP_MALLOC and TEMP_FREE will only be called in stack fashion - frees in the reverse order of mallocs
 // and any temp memory allocated by a function will be freed before it exits.
-// MALLOC and FREE are used only by GifBegin and GifEnd respectively (to allocate a buffer the size of the image, which
-// is used to find changed pixels for delta-encoding.)
+// MALLOC and FREE are used for longer lived buffers: the one GifBegin allocates the size of the image, which
+// is used to find changed pixels for delta-encoding, output buffers, and LZW dictionaries.
 
 #ifndef GIF_TEMP_MALLOC
 #include <stdlib.h>
@@ -347,6 +348,9 @@ int GifPickChangedPixels( const uint8_t* lastFrame, uint8_t* frame, int numPixel
 // This is known as the "modified median split" technique
 void GifMakePalette( const uint8_t* lastFrame, const uint8_t* nextFrame, uint32_t width, uint32_t height, int bitDepth, bool buildForDither, GifPalette* pPal )
 {
+    // a frame with no changed pixels gets no colors, so the table is cleared rather
+    // than written out with whatever was in memory
+    memset(pPal, 0, sizeof(GifPalette));
     pPal->bitDepth = bitDepth;
 
     // SplitPalette is destructive (it sorts the pixels by color) so
@@ -521,73 +525,213 @@ void GifThresholdImage( const uint8_t* lastFrame, const uint8_t* nextFrame, uint
     }
 }
 
-// Simple structure to write out the LZW-compressed portion of the image
-// one bit at a time
-struct GifBitStatus
+// Where encoded bytes go. Bytes collect in a buffer, which is handed on in blocks of
+// kGifBlockSize to a file or to a write function, so the rest of the writer never
+// makes a call per byte. With neither, everything stays in the buffer, which lets
+// frames be compressed on several threads and written out in order.
+typedef size_t (*GifWriteFunc)( void* context, const uint8_t* bytes, size_t count );
+
+const size_t kGifBlockSize = 1 << 16;
+
+struct GifOutput
 {
-    uint8_t bitIndex;  // how many bits in the partial byte written so far
-    uint8_t byte;      // current partial byte
+    FILE* f;
+    GifWriteFunc write;
+    void* context;
 
-    uint32_t chunkIndex;
-    uint8_t chunk[256];   // bytes are written in here until we have 256 of them, then written to the file
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+
+    bool failed; // a block couldn't be written
 };
 
-// insert a single bit
-void GifWriteBit( GifBitStatus& stat, uint32_t bit )
+GifOutput GifFileOutput( FILE* f )
 {
-    bit = bit & 1;
-    bit = bit << stat.bitIndex;
-    stat.byte |= bit;
+    GifOutput out = { f, NULL, NULL, NULL, 0, 0, false };
+    return out;
+}
 
-    ++stat.bitIndex;
-    if( stat.bitIndex > 7 )
-    {
-        // move the newly-finished byte to the chunk buffer
-        stat.chunk[stat.chunkIndex++] = stat.byte;
-        // and start a new byte
-        stat.bitIndex = 0;
-        stat.byte = 0;
-    }
+GifOutput GifFunctionOutput( GifWriteFunc write, void* context )
+{
+    GifOutput out = { NULL, write, context, NULL, 0, 0, false };
+    return out;
 }
 
-// write all bytes so far to the file
-void GifWriteChunk( FILE* f, GifBitStatus& stat )
+GifOutput GifMemoryOutput()
 {
-    fputc((int)stat.chunkIndex, f);
-    fwrite(stat.chunk, 1, stat.chunkIndex, f);
+    GifOutput out = { NULL, NULL, NULL, NULL, 0, 0, false };
+    return out;
+}
+
+// hand whatever is buffered to the file or write function
+void GifFlush( GifOutput* out )
+{
+    if( !out->size || (!out->f && !out->write) ) return;
+
+    size_t written = out->f? fwrite(out->data, 1, out->size, out->f) : out->write(out->context, out->data, out->size);
+    if( written != out->size ) out->failed = true;
+    out->size = 0;
+}
+
+// flush, and free the buffer; a memory output's bytes go with it
+void GifFreeOutput( GifOutput* out )
+{
+    GifFlush(out);
+    if( out->data ) GIF_FREE(out->data);
+
+    out->data = NULL;
+    out->size = 0;
+    out->capacity = 0;
+}
+
+void GifReserve( GifOutput* out, size_t count )
+{
+    if( out->size + count <= out->capacity ) return;
+
+    size_t capacity = out->capacity? out->capacity : 4096;
+    while( capacity < out->size + count ) capacity *= 2;
+
+    uint8_t* data = (uint8_t*)GIF_MALLOC(capacity);
+    if( out->size ) memcpy(data, out->data, out->size);
+    if( out->data ) GIF_FREE(out->data);
+
+    out->data = data;
+    out->capacity = capacity;
+}
+
+void GifPutBytes( GifOutput* out, const uint8_t* bytes, size_t count )
+{
+    GifReserve(out, count);
+    memcpy(out->data + out->size, bytes, count);
+    out->size += count;
+
+    if( out->size >= kGifBlockSize ) GifFlush(out);
+}
+
+void GifPutByte( GifOutput* out, int byte )
+{
+    if( out->size == out->capacity ) GifReserve(out, 1);
+    out->data[out->size++] = (uint8_t)byte;
+
+    if( out->size >= kGifBlockSize ) GifFlush(out);
+}
+
+// Packs LZW codes least significant bit first into sub-blocks of up to 255 bytes.
+// Codes are at most 12 bits, so they're added to a 64 bit register and only whole
+// bytes are moved out of it, rather than going a bit at a time.
+struct GifBitStatus
+{
+    uint64_t bits;      // bits not yet moved to the chunk, lowest first
+    uint32_t bitCount;  // how many of them there are
+
+    uint32_t chunkIndex;
+    uint8_t chunk[256];   // bytes are written in here until we have 255 of them, then written to the output
+};
+
+// write all bytes so far to the output
+void GifWriteChunk( GifOutput* out, GifBitStatus& stat )
+{
+    GifPutByte(out, (int)stat.chunkIndex);
+    GifPutBytes(out, stat.chunk, stat.chunkIndex);
 
-    stat.bitIndex = 0;
-    stat.byte = 0;
     stat.chunkIndex = 0;
 }
 
-void GifWriteCode( FILE* f, GifBitStatus& stat, uint32_t code, uint32_t length )
+void GifWriteCode( GifOutput* out, GifBitStatus& stat, uint32_t code, uint32_t length )
 {
-    for( uint32_t ii=0; ii<length; ++ii )
+    stat.bits |= (uint64_t)code << stat.bitCount;
+    stat.bitCount += length;
+
+    // never more than 7 + 12 bits are held, so at most two bytes come out
+    while( stat.bitCount >= 8 )
     {
-        GifWriteBit(stat, code);
-        code = code >> 1;
+        stat.chunk[stat.chunkIndex++] = (uint8_t)stat.bits;
+        stat.bits >>= 8;
+        stat.bitCount -= 8;
 
         if( stat.chunkIndex == 255 )
         {
-            GifWriteChunk(f, stat);
+            GifWriteChunk(out, stat);
         }
     }
 }
 
-// The LZW dictionary is a 256-ary tree constructed as the file is encoded,
-// this is one node
-struct GifLzwNode
+// pad the last partial byte with zeros and write out the last partial chunk
+void GifFinishCodes( GifOutput* out, GifBitStatus& stat )
+{
+    if( stat.bitCount )
+    {
+        stat.chunk[stat.chunkIndex++] = (uint8_t)stat.bits;
+        stat.bits = 0;
+        stat.bitCount = 0;
+    }
+
+    if( stat.chunkIndex ) GifWriteChunk(out, stat);
+}
+
+// The LZW dictionary maps a run already in it plus one more value to the run's code.
+// It holds at most 4096 codes, so it's kept in a hash table twice that size, open
+// addressed with linear probing: 64 KB rather than a 2 MB 256-ary tree. Each slot
+// records which generation it was filled in, so clearing the dictionary is just
+// starting a new generation instead of wiping the table.
+const uint32_t kGifLzwTableBits = 13;
+const uint32_t kGifLzwTableSize = 1 << kGifLzwTableBits;
+
+struct GifLzwSlot
+{
+    uint32_t generation; // the slot is empty unless this is the table's generation
+    uint32_t entry;      // run code << 20 | value << 12 | code of the longer run
+};
+
+struct GifLzwTable
 {
-    uint16_t m_next[256];
+    GifLzwSlot* entries;
+    uint32_t generation;
 };
 
-// write a 256-color (8-bit) image palette to the file
-void GifWritePalette( const GifPalette* pPal, FILE* f )
+void GifInitLzwTable( GifLzwTable* table )
 {
-    fputc(0, f);  // first color: transparency
-    fputc(0, f);
-    fputc(0, f);
+    table->entries = (GifLzwSlot*)GIF_MALLOC(sizeof(GifLzwSlot)*kGifLzwTableSize);
+    memset(table->entries, 0, sizeof(GifLzwSlot)*kGifLzwTableSize);
+    table->generation = 0;
+}
+
+void GifFreeLzwTable( GifLzwTable* table )
+{
+    GIF_FREE(table->entries);
+    table->entries = NULL;
+}
+
+// empty the dictionary
+void GifResetLzwTable( GifLzwTable* table )
+{
+    if( ++table->generation == 0 )
+    {
+        // after 4 billion resets the old generations come round again
+        memset(table->entries, 0, sizeof(GifLzwSlot)*kGifLzwTableSize);
+        table->generation = 1;
+    }
+}
+
+// the slot holding key, which is run code << 8 | value, or the empty slot where it would go
+GifLzwSlot* GifFindLzwSlot( GifLzwTable* table, uint32_t key )
+{
+    uint32_t index = (key * 2654435761u) >> (32 - kGifLzwTableBits);
+    for( ;; )
+    {
+        GifLzwSlot* slot = &table->entries[index];
+        if( slot->generation != table->generation || (slot->entry >> 12) == key ) return slot;
+        index = (index + 1) & (kGifLzwTableSize - 1);
+    }
+}
+
+// write a 256-color (8-bit) image palette to the output
+void GifWritePalette( const GifPalette* pPal, GifOutput* out )
+{
+    GifPutByte(out, 0);  // first color: transparency
+    GifPutByte(out, 0);
+    GifPutByte(out, 0);
 
     for(int ii=1; ii<(1 << pPal->bitDepth); ++ii)
     {
@@ -595,61 +739,83 @@ void GifWritePalette( const GifPalette* pPal, FILE* f )
         uint32_t g = pPal->g[ii];
         uint32_t b = pPal->b[ii];
 
-        fputc((int)r, f);
-        fputc((int)g, f);
-        fputc((int)b, f);
+        GifPutByte(out, (int)r);
+        GifPutByte(out, (int)g);
+        GifPutByte(out, (int)b);
     }
 }
 
+// what the decoder does with a frame's rectangle before drawing the next one
+const uint32_t kGifDisposeNone = 1;      // leave the frame in place
+const uint32_t kGifDisposePrevious = 3;  // put back what was there before the frame
+
 // write the image header, LZW-compress and write out the image
-void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uint32_t width, uint32_t height, uint32_t delay, GifPalette* pPal)
+// with localPalette false, the image uses the global color table written by GifBegin
+// and pPal only gives its bit depth
+// the dictionary is kept in table if one is given, so it can be reused from frame to frame
+// image is width by height and is drawn at left, top; disposal says what becomes of it
+// once it has been shown, one of the kGifDispose values
+void GifWriteLzwImage(GifOutput* out, const uint8_t* image, uint32_t left, uint32_t top,  uint32_t width, uint32_t height, uint32_t delay, GifPalette* pPal, bool localPalette = true, GifLzwTable* table = NULL, uint32_t disposal = kGifDisposeNone)
 {
     // graphics control extension
-    fputc(0x21, f);
-    fputc(0xf9, f);
-    fputc(0x04, f);
-    fputc(0x05, f); // leave prev frame in place, this frame has transparency
-    fputc(delay & 0xff, f);
-    fputc((delay >> 8) & 0xff, f);
-    fputc(kGifTransIndex, f); // transparent color index
-    fputc(0, f);
-
-    fputc(0x2c, f); // image descriptor block
-
-    fputc(left & 0xff, f);           // corner of image in canvas space
-    fputc((left >> 8) & 0xff, f);
-    fputc(top & 0xff, f);
-    fputc((top >> 8) & 0xff, f);
-
-    fputc(width & 0xff, f);          // width and height of image
-    fputc((width >> 8) & 0xff, f);
-    fputc(height & 0xff, f);
-    fputc((height >> 8) & 0xff, f);
-
-    //fputc(0, f); // no local color table, no transparency
-    //fputc(0x80, f); // no local color table, but transparency
-
-    fputc(0x80 + pPal->bitDepth-1, f); // local color table present, 2 ^ bitDepth entries
-    GifWritePalette(pPal, f);
+    GifPutByte(out, 0x21);
+    GifPutByte(out, 0xf9);
+    GifPutByte(out, 0x04);
+    GifPutByte(out, (int)(disposal << 2) | 0x01); // what to do with this frame afterwards, this frame has transparency
+    GifPutByte(out, delay & 0xff);
+    GifPutByte(out, (delay >> 8) & 0xff);
+    GifPutByte(out, kGifTransIndex); // transparent color index
+    GifPutByte(out, 0);
+
+    GifPutByte(out, 0x2c); // image descriptor block
+
+    GifPutByte(out, left & 0xff);           // corner of image in canvas space
+    GifPutByte(out, (left >> 8) & 0xff);
+    GifPutByte(out, top & 0xff);
+    GifPutByte(out, (top >> 8) & 0xff);
+
+    GifPutByte(out, width & 0xff);          // width and height of image
+    GifPutByte(out, (width >> 8) & 0xff);
+    GifPutByte(out, height & 0xff);
+    GifPutByte(out, (height >> 8) & 0xff);
+
+    //GifPutByte(out, 0); // no local color table, no transparency
+    //GifPutByte(out, 0x80); // no local color table, but transparency
+
+    if( localPalette )
+    {
+        GifPutByte(out, 0x80 + pPal->bitDepth-1); // local color table present, 2 ^ bitDepth entries
+        GifWritePalette(pPal, out);
+    }
+    else
+    {
+        GifPutByte(out, 0); // no local color table
+    }
 
-    const int minCodeSize = pPal->bitDepth;
-    const uint32_t clearCode = 1 << pPal->bitDepth;
+    // LZW codes start at 2 bits even for 1-bit images
+    const int minCodeSize = pPal->bitDepth < 2? 2 : pPal->bitDepth;
+    const uint32_t clearCode = 1 << minCodeSize;
 
-    fputc(minCodeSize, f); // min code size 8 bits
+    GifPutByte(out, minCodeSize); // min code size, 8 bits for a full palette
 
-    GifLzwNode* codetree = (GifLzwNode*)GIF_TEMP_MALLOC(sizeof(GifLzwNode)*4096);
+    GifLzwTable ownTable;
+    if( !table )
+    {
+        GifInitLzwTable(&ownTable);
+        table = &ownTable;
+    }
 
-    memset(codetree, 0, sizeof(GifLzwNode)*4096);
+    GifResetLzwTable(table);
     int32_t curCode = -1;
     uint32_t codeSize = (uint32_t)minCodeSize + 1;
     uint32_t maxCode = clearCode+1;
 
     GifBitStatus stat;
-    stat.byte = 0;
-    stat.bitIndex = 0;
+    stat.bits = 0;
+    stat.bitCount = 0;
     stat.chunkIndex = 0;
 
-    GifWriteCode(f, stat, clearCode, codeSize);  // start with a fresh LZW dictionary
+    GifWriteCode(out, stat, clearCode, codeSize);  // start with a fresh LZW dictionary
 
     for(uint32_t yy=0; yy<height; ++yy)
     {
@@ -658,26 +824,32 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
             uint8_t nextValue = image[(yy*width+xx)*4+3];
 
             // "loser mode" - no compression, every single code is followed immediately by a clear
-            //WriteCode( f, stat, nextValue, codeSize );
-            //WriteCode( f, stat, 256, codeSize );
+            //WriteCode( out, stat, nextValue, codeSize );
+            //WriteCode( out, stat, 256, codeSize );
 
             if( curCode < 0 )
             {
                 // first value in a new run
                 curCode = nextValue;
             }
-            else if( codetree[curCode].m_next[nextValue] )
-            {
-                // current run already in the dictionary
-                curCode = codetree[curCode].m_next[nextValue];
-            }
             else
             {
+                uint32_t key = ((uint32_t)curCode << 8) | nextValue;
+                GifLzwSlot* slot = GifFindLzwSlot(table, key);
+
+                if( slot->generation == table->generation )
+                {
+                    // current run already in the dictionary
+                    curCode = (int32_t)(slot->entry & 0xfff);
+                    continue;
+                }
+
                 // finish the current run, write a code
-                GifWriteCode(f, stat, (uint32_t)curCode, codeSize);
+                GifWriteCode(out, stat, (uint32_t)curCode, codeSize);
 
                 // insert the new run into the dictionary
-                codetree[curCode].m_next[nextValue] = (uint16_t)++maxCode;
+                slot->generation = table->generation;
+                slot->entry = (key << 12) | ++maxCode;
 
                 if( maxCode >= (1ul << codeSize) )
                 {
@@ -688,9 +860,9 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
                 if( maxCode == 4095 )
                 {
                     // the dictionary is full, clear it out and begin anew
-                    GifWriteCode(f, stat, clearCode, codeSize); // clear tree
+                    GifWriteCode(out, stat, clearCode, codeSize); // clear tree
 
-                    memset(codetree, 0, sizeof(GifLzwNode)*4096);
+                    GifResetLzwTable(table);
                     codeSize = (uint32_t)(minCodeSize + 1);
                     maxCode = clearCode+1;
                 }
@@ -701,82 +873,158 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
     }
 
     // compression footer
-    GifWriteCode(f, stat, (uint32_t)curCode, codeSize);
-    GifWriteCode(f, stat, clearCode, codeSize);
-    GifWriteCode(f, stat, clearCode + 1, (uint32_t)minCodeSize + 1);
+    GifWriteCode(out, stat, (uint32_t)curCode, codeSize);
+    GifWriteCode(out, stat, clearCode, codeSize);
+    GifWriteCode(out, stat, clearCode + 1, (uint32_t)minCodeSize + 1);
+
+    GifFinishCodes(out, stat);
+
+    GifPutByte(out, 0); // image block terminator
+
+    if( table == &ownTable ) GifFreeLzwTable(&ownTable);
+}
+
+// A rectangle of the canvas a frame is drawn in
+struct GifRect
+{
+    uint32_t left;
+    uint32_t top;
+    uint32_t width;
+    uint32_t height;
+};
+
+// Finds the smallest rectangle around the pixels of a thresholded or dithered frame that
+// aren't transparent, which are the only ones that change the canvas. With no such pixels
+// it's the top left pixel, since a frame can't be empty.
+GifRect GifChangedRect( const uint8_t* image, uint32_t width, uint32_t height )
+{
+    uint32_t left = width, right = 0, top = height, bottom = 0;
+
+    for( uint32_t yy=0; yy<height; ++yy )
+    {
+        const uint8_t* row = image + yy*width*4;
+        for( uint32_t xx=0; xx<width; ++xx )
+        {
+            if( row[xx*4+3] == kGifTransIndex ) continue;
+
+            if( xx < left ) left = xx;
+            if( xx > right ) right = xx;
+            if( yy < top ) top = yy;
+            bottom = yy;
+        }
+    }
 
-    // write out the last partial chunk
-    while( stat.bitIndex ) GifWriteBit(stat, 0);
-    if( stat.chunkIndex ) GifWriteChunk(f, stat);
+    GifRect rect = { 0, 0, 1, 1 };
+    if( left < width )
+    {
+        rect.left = left;
+        rect.top = top;
+        rect.width = right - left + 1;
+        rect.height = bottom - top + 1;
+    }
 
-    fputc(0, f); // image block terminator
+    return rect;
+}
 
-    GIF_TEMP_FREE(codetree);
+// copy a rectangle of an image, width pixels wide, into out, which holds rect.width*rect.height pixels
+void GifCropImage( const uint8_t* image, uint32_t width, GifRect rect, uint8_t* out )
+{
+    for( uint32_t yy=0; yy<rect.height; ++yy )
+    {
+        memcpy(out + yy*rect.width*4, image + ((rect.top+yy)*width + rect.left)*4, rect.width*4);
+    }
 }
 
 struct GifWriter
 {
-    FILE* f;
+    GifOutput out;
+    bool ownsFile; // the file was opened by GifBegin, so GifEnd closes it
     uint8_t* oldImage;
     bool firstFrame;
+    GifLzwTable lzw; // reused by every frame
 };
 
-// Creates a gif file.
+// Starts a gif written to out, which the writer takes over.
 // The input GIFWriter is assumed to be uninitialized.
 // The delay value is the time between frames in hundredths of a second - note that not all viewers pay much attention to this value.
-bool GifBegin( GifWriter* writer, const char* filename, uint32_t width, uint32_t height, uint32_t delay, int32_t bitDepth = 8, bool dither = false )
+// With a global palette, it's written as the global color table and frames should be
+// written with GifWriteLzwImage using it, rather than with GifWriteFrame.
+void GifBeginOutput( GifWriter* writer, GifOutput out, uint32_t width, uint32_t height, uint32_t delay, const GifPalette* globalPalette = NULL )
 {
-    (void)bitDepth; (void)dither; // Mute "Unused argument" warnings
-#if defined(_MSC_VER) && (_MSC_VER >= 1400)
-    writer->f = 0;
-    fopen_s(&writer->f, filename, "wb");
-#else
-    writer->f = fopen(filename, "wb");
-#endif
-    if(!writer->f) return false;
-
+    writer->out = out;
+    writer->ownsFile = false;
     writer->firstFrame = true;
 
     // allocate
     writer->oldImage = (uint8_t*)GIF_MALLOC(width*height*4);
+    GifInitLzwTable(&writer->lzw);
 
-    fputs("GIF89a", writer->f);
+    GifOutput* o = &writer->out;
+    GifPutBytes(o, (const uint8_t*)"GIF89a", 6);
 
     // screen descriptor
-    fputc(width & 0xff, writer->f);
-    fputc((width >> 8) & 0xff, writer->f);
-    fputc(height & 0xff, writer->f);
-    fputc((height >> 8) & 0xff, writer->f);
-
-    fputc(0xf0, writer->f);  // there is an unsorted global color table of 2 entries
-    fputc(0, writer->f);     // background color
-    fputc(0, writer->f);     // pixels are square (we need to specify this because it's 1989)
-
-    // now the "global" palette (really just a dummy palette)
-    // color 0: black
-    fputc(0, writer->f);
-    fputc(0, writer->f);
-    fputc(0, writer->f);
-    // color 1: also black
-    fputc(0, writer->f);
-    fputc(0, writer->f);
-    fputc(0, writer->f);
+    GifPutByte(o, width & 0xff);
+    GifPutByte(o, (width >> 8) & 0xff);
+    GifPutByte(o, height & 0xff);
+    GifPutByte(o, (height >> 8) & 0xff);
+
+    if( globalPalette )
+    {
+        GifPutByte(o, 0xf0 + globalPalette->bitDepth-1);  // there is an unsorted global color table of 2 ^ bitDepth entries
+        GifPutByte(o, 0);     // background color
+        GifPutByte(o, 0);     // pixels are square
+
+        GifWritePalette(globalPalette, o);
+    }
+    else
+    {
+        GifPutByte(o, 0xf0);  // there is an unsorted global color table of 2 entries
+        GifPutByte(o, 0);     // background color
+        GifPutByte(o, 0);     // pixels are square (we need to specify this because it's 1989)
+
+        // now the "global" palette (really just a dummy palette)
+        // color 0: black
+        GifPutByte(o, 0);
+        GifPutByte(o, 0);
+        GifPutByte(o, 0);
+        // color 1: also black
+        GifPutByte(o, 0);
+        GifPutByte(o, 0);
+        GifPutByte(o, 0);
+    }
 
     if( delay != 0 )
     {
         // animation header
-        fputc(0x21, writer->f); // extension
-        fputc(0xff, writer->f); // application specific
-        fputc(11, writer->f); // length 11
-        fputs("NETSCAPE2.0", writer->f); // yes, really
-        fputc(3, writer->f); // 3 bytes of NETSCAPE2.0 data
+        GifPutByte(o, 0x21); // extension
+        GifPutByte(o, 0xff); // application specific
+        GifPutByte(o, 11); // length 11
+        GifPutBytes(o, (const uint8_t*)"NETSCAPE2.0", 11); // yes, really
+        GifPutByte(o, 3); // 3 bytes of NETSCAPE2.0 data
 
-        fputc(1, writer->f); // JUST BECAUSE
-        fputc(0, writer->f); // loop infinitely (byte 0)
-        fputc(0, writer->f); // loop infinitely (byte 1)
+        GifPutByte(o, 1); // JUST BECAUSE
+        GifPutByte(o, 0); // loop infinitely (byte 0)
+        GifPutByte(o, 0); // loop infinitely (byte 1)
 
-        fputc(0, writer->f); // block terminator
+        GifPutByte(o, 0); // block terminator
     }
+}
+
+// Creates a gif file, see GifBeginOutput. The file is written in blocks of kGifBlockSize.
+bool GifBegin( GifWriter* writer, const char* filename, uint32_t width, uint32_t height, uint32_t delay, int32_t bitDepth = 8, bool dither = false, const GifPalette* globalPalette = NULL )
+{
+    (void)bitDepth; (void)dither; // Mute "Unused argument" warnings
+    FILE* f;
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+    f = 0;
+    fopen_s(&f, filename, "wb");
+#else
+    f = fopen(filename, "wb");
+#endif
+    if(!f) return false;
+
+    GifBeginOutput(writer, GifFileOutput(f), width, height, delay, globalPalette);
+    writer->ownsFile = true;
 
     return true;
 }
@@ -787,7 +1035,7 @@ bool GifBegin( GifWriter* writer, const char* filename, uint32_t width, uint32_t
 // this may be handy to save bits in animations that don't change much.
 bool GifWriteFrame( GifWriter* writer, const uint8_t* image, uint32_t width, uint32_t height, uint32_t delay, int bitDepth = 8, bool dither = false )
 {
-    if(!writer->f) return false;
+    if(!writer->oldImage) return false;
 
     const uint8_t* oldImage = writer->firstFrame? NULL : writer->oldImage;
     writer->firstFrame = false;
@@ -800,26 +1048,40 @@ bool GifWriteFrame( GifWriter* writer, const uint8_t* image, uint32_t width, uin
     else
         GifThresholdImage(oldImage, image, writer->oldImage, width, height, &pal);
 
-    GifWriteLzwImage(writer->f, writer->oldImage, 0, 0, width, height, delay, &pal);
+    // only the part of the frame that changed is written
+    GifRect rect = GifChangedRect(writer->oldImage, width, height);
+    uint8_t* changed = (uint8_t*)GIF_TEMP_MALLOC(rect.width*rect.height*4);
+    GifCropImage(writer->oldImage, width, rect, changed);
+
+    GifWriteLzwImage(&writer->out, changed, rect.left, rect.top, rect.width, rect.height, delay, &pal, true, &writer->lzw);
+
+    GIF_TEMP_FREE(changed);
 
     return true;
 }
 
-// Writes the EOF code, closes the file handle, and frees temp memory used by a GIF.
+// Writes the EOF code, flushes the output, closes the file handle if GifBegin opened it,
+// and frees temp memory used by a GIF. Returns false if any of it couldn't be written.
 // Many if not most viewers will still display a GIF properly if the EOF code is missing,
 // but it's still a good idea to write it out.
 bool GifEnd( GifWriter* writer )
 {
-    if(!writer->f) return false;
+    if(!writer->oldImage) return false;
+
+    GifPutByte(&writer->out, 0x3b); // end of file
 
-    fputc(0x3b, writer->f); // end of file
-    fclose(writer->f);
+    // a memory output keeps its bytes for the caller to take and free with GifFreeOutput
+    if( writer->out.f || writer->out.write ) GifFreeOutput(&writer->out);
+
+    bool written = !writer->out.failed;
+    if( writer->ownsFile && fclose(writer->out.f) != 0 ) written = false;
     GIF_FREE(writer->oldImage);
+    GifFreeLzwTable(&writer->lzw);
 
-    writer->f = NULL;
+    writer->out.f = NULL;
     writer->oldImage = NULL;
 
-    return true;
+    return written;
 }
 
 #endif
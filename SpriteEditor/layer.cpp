@@ -0,0 +1,478 @@
+#include "layer.h"
+#include <QVector>
+#include <QPoint>
+#include <cstring>
+
+const int Tile::SIZE;
+
+Layer::Layer(int width, int height, QString name)
+{
+    this->name = name;
+    opacity = 255;
+    visible = true;
+    reset(width, height);
+}
+
+void Layer::reset(int newWidth, int newHeight)
+{
+    width = newWidth;
+    height = newHeight;
+    tileColumns = (width + Tile::SIZE - 1)/Tile::SIZE;
+    tileRows = (height + Tile::SIZE - 1)/Tile::SIZE;
+    tiles.clear();
+}
+
+QSharedDataPointer<Tile> Layer::createTile()
+{
+    QSharedDataPointer<Tile> tile(new Tile);
+    std::fill(tile->pixels, tile->pixels + Tile::SIZE*Tile::SIZE, qRgba(0, 0, 0, 0));
+    return tile;
+}
+
+int Layer::tileIndex(int x, int y) const
+{
+    return (y/Tile::SIZE)*tileColumns + x/Tile::SIZE;
+}
+
+int Layer::getWidth() const
+{
+    return width;
+}
+
+int Layer::getHeight() const
+{
+    return height;
+}
+
+int Layer::getTileColumns() const
+{
+    return tileColumns;
+}
+
+int Layer::getTileRows() const
+{
+    return tileRows;
+}
+
+QString Layer::getName() const
+{
+    return name;
+}
+
+void Layer::setName(QString name)
+{
+    this->name = name;
+}
+
+int Layer::getOpacity() const
+{
+    return opacity;
+}
+
+void Layer::setOpacity(int opacity)
+{
+    this->opacity = std::max(0, std::min(opacity, 255));
+}
+
+bool Layer::isVisible() const
+{
+    return visible;
+}
+
+void Layer::setVisible(bool visible)
+{
+    this->visible = visible;
+}
+
+int Layer::getAllocatedTileCount() const
+{
+    return tiles.size();
+}
+
+QList<int> Layer::getAllocatedTiles() const
+{
+    return tiles.keys();
+}
+
+const QRgb* Layer::getTilePixels(int tileColumn, int tileRow) const
+{
+    QHash<int, QSharedDataPointer<Tile>>::const_iterator tile = tiles.constFind(tileRow*tileColumns + tileColumn);
+
+    if (tile == tiles.constEnd())
+    {
+        return nullptr;
+    }
+
+    return tile.value()->pixels;
+}
+
+void Layer::setTilePixels(int tileColumn, int tileRow, const QRgb* pixels)
+{
+    QSharedDataPointer<Tile> tile(new Tile);
+    std::memcpy(tile->pixels, pixels, sizeof(tile->pixels));
+    tiles.insert(tileRow*tileColumns + tileColumn, tile);
+}
+
+void Layer::shareTile(const Layer& other, int tileColumn, int tileRow)
+{
+    int index = tileRow*tileColumns + tileColumn;
+    QHash<int, QSharedDataPointer<Tile>>::const_iterator tile = other.tiles.constFind(index);
+
+    if (tile != other.tiles.constEnd())
+    {
+        tiles.insert(index, tile.value());
+    }
+    else
+    {
+        tiles.remove(index);
+    }
+}
+
+QRgb Layer::getPixelRgb(int x, int y) const
+{
+    const QRgb* pixels = getTilePixels(x/Tile::SIZE, y/Tile::SIZE);
+
+    if (pixels == nullptr)
+    {
+        return qRgba(0, 0, 0, 0);
+    }
+
+    return pixels[(y % Tile::SIZE)*Tile::SIZE + x % Tile::SIZE];
+}
+
+void Layer::setPixelRgb(int x, int y, QRgb rgb)
+{
+    // Writing a pixel's own color back shouldn't cost a tile copy
+    if (getPixelRgb(x, y) == rgb)
+    {
+        return;
+    }
+
+    QSharedDataPointer<Tile>& tile = tiles[tileIndex(x, y)];
+
+    if (!tile)
+    {
+        tile = createTile();
+    }
+
+    tile->pixels[(y % Tile::SIZE)*Tile::SIZE + x % Tile::SIZE] = rgb;
+}
+
+QRect Layer::floodFill(int x, int y, QRgb rgb)
+{
+    QRgb target = getPixelRgb(x, y);
+
+    if (target == rgb)
+    {
+        return QRect();
+    }
+
+    // Reads go through the tile they fall in, which only gets looked up again
+    // when a read crosses into another tile
+    int cachedIndex = -1;
+    const QRgb* cachedPixels = nullptr;
+    auto isTarget = [&](int pixelX, int pixelY) -> bool
+    {
+        int index = tileIndex(pixelX, pixelY);
+
+        if (index != cachedIndex)
+        {
+            cachedIndex = index;
+            cachedPixels = getTilePixels(pixelX/Tile::SIZE, pixelY/Tile::SIZE);
+        }
+
+        QRgb pixel = cachedPixels == nullptr ? qRgba(0, 0, 0, 0)
+                                             : cachedPixels[(pixelY % Tile::SIZE)*Tile::SIZE + pixelX % Tile::SIZE];
+        return pixel == target;
+    };
+
+    // Writes fill a whole span of a tile row at once
+    auto fillSpan = [&](int left, int right, int row)
+    {
+        for (int tileX = left - left % Tile::SIZE; tileX <= right; tileX += Tile::SIZE)
+        {
+            QSharedDataPointer<Tile>& tile = tiles[tileIndex(tileX, row)];
+
+            if (!tile)
+            {
+                tile = createTile();
+            }
+
+            QRgb* line = tile->pixels + (row % Tile::SIZE)*Tile::SIZE;
+            int first = std::max(left, tileX) - tileX;
+            int last = std::min(right, tileX + Tile::SIZE - 1) - tileX;
+            std::fill(line + first, line + last + 1, rgb);
+        }
+
+        // Filling may have created or copied the cached tile
+        cachedIndex = -1;
+    };
+
+    QRect changed;
+    QVector<QPoint> seeds;
+    seeds.append(QPoint(x, y));
+
+    while (!seeds.isEmpty())
+    {
+        QPoint seed = seeds.takeLast();
+        int row = seed.y();
+
+        if (!isTarget(seed.x(), row))
+        {
+            continue;
+        }
+
+        int left = seed.x();
+        while (left > 0 && isTarget(left - 1, row))
+        {
+            left--;
+        }
+        int right = seed.x();
+        while (right < width - 1 && isTarget(right + 1, row))
+        {
+            right++;
+        }
+
+        fillSpan(left, right, row);
+        changed = changed.united(QRect(left, row, right - left + 1, 1));
+
+        // One seed per run of matching pixels in the rows above and below
+        int neighbors[] = { row - 1, row + 1 };
+        for (int neighbor : neighbors)
+        {
+            if (neighbor < 0 || neighbor >= height)
+            {
+                continue;
+            }
+
+            bool inRun = false;
+            for (int column = left; column <= right; column++)
+            {
+                bool matches = isTarget(column, neighbor);
+
+                if (matches && !inRun)
+                {
+                    seeds.append(QPoint(column, neighbor));
+                }
+                inRun = matches;
+            }
+        }
+    }
+
+    return changed;
+}
+
+QImage Layer::copyArea(QRect area) const
+{
+    QImage image(area.size(), QImage::Format_ARGB32);
+    image.fill(Qt::transparent);
+
+    QRect inside = area.intersected(QRect(0, 0, width, height));
+
+    for (int row = inside.top(); row <= inside.bottom(); row++)
+    {
+        QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(row - area.top()));
+
+        for (int tileX = inside.left() - inside.left() % Tile::SIZE; tileX <= inside.right(); tileX += Tile::SIZE)
+        {
+            const QRgb* pixels = getTilePixels(tileX/Tile::SIZE, row/Tile::SIZE);
+
+            // Missing tiles are already transparent in the image
+            if (pixels == nullptr)
+            {
+                continue;
+            }
+
+            int first = std::max(inside.left(), tileX);
+            int last = std::min(inside.right(), tileX + Tile::SIZE - 1);
+            std::memcpy(line + first - area.left(), pixels + (row % Tile::SIZE)*Tile::SIZE + first - tileX,
+                        (last - first + 1)*sizeof(QRgb));
+        }
+    }
+
+    return image;
+}
+
+void Layer::pasteImage(QPoint topLeft, const QImage& source)
+{
+    QImage image = source.convertToFormat(QImage::Format_ARGB32);
+    QRect inside = QRect(topLeft, image.size()).intersected(QRect(0, 0, width, height));
+
+    for (int row = inside.top(); row <= inside.bottom(); row++)
+    {
+        const QRgb* line = reinterpret_cast<const QRgb*>(image.constScanLine(row - topLeft.y()));
+
+        for (int tileX = inside.left() - inside.left() % Tile::SIZE; tileX <= inside.right(); tileX += Tile::SIZE)
+        {
+            int first = std::max(inside.left(), tileX);
+            int last = std::min(inside.right(), tileX + Tile::SIZE - 1);
+            const QRgb* from = line + first - topLeft.x();
+            int count = last - first + 1;
+
+            int index = tileIndex(tileX, row);
+
+            if (!tiles.contains(index))
+            {
+                // Pasting nothing onto nothing shouldn't cost a tile
+                if (std::all_of(from, from + count, [](QRgb pixel) { return pixel == qRgba(0, 0, 0, 0); }))
+                {
+                    continue;
+                }
+
+                tiles.insert(index, createTile());
+            }
+
+            QSharedDataPointer<Tile>& tile = tiles[index];
+            std::memcpy(tile->pixels + (row % Tile::SIZE)*Tile::SIZE + first - tileX, from, count*sizeof(QRgb));
+        }
+    }
+}
+
+void Layer::clearArea(QRect area)
+{
+    QRect inside = area.intersected(QRect(0, 0, width, height));
+
+    if (inside.isEmpty())
+    {
+        return;
+    }
+
+    for (int tileRow = inside.top()/Tile::SIZE; tileRow <= inside.bottom()/Tile::SIZE; tileRow++)
+    {
+        for (int tileColumn = inside.left()/Tile::SIZE; tileColumn <= inside.right()/Tile::SIZE; tileColumn++)
+        {
+            int index = tileRow*tileColumns + tileColumn;
+
+            if (!tiles.contains(index))
+            {
+                continue;
+            }
+
+            // Only the part of a tile that's on the layer matters, the rest is always transparent
+            QRect tileArea = QRect(tileColumn*Tile::SIZE, tileRow*Tile::SIZE, Tile::SIZE, Tile::SIZE)
+                    .intersected(QRect(0, 0, width, height));
+            QRect cleared = tileArea.intersected(inside);
+
+            if (cleared == tileArea)
+            {
+                tiles.remove(index);
+                continue;
+            }
+
+            QSharedDataPointer<Tile>& tile = tiles[index];
+            for (int row = cleared.top(); row <= cleared.bottom(); row++)
+            {
+                QRgb* line = tile->pixels + (row % Tile::SIZE)*Tile::SIZE;
+                std::fill(line + cleared.left() % Tile::SIZE, line + cleared.right() % Tile::SIZE + 1, qRgba(0, 0, 0, 0));
+            }
+        }
+    }
+}
+
+QImage Layer::toImage() const
+{
+    QImage image(width, height, QImage::Format_ARGB32);
+    image.fill(Qt::transparent);
+
+    // Empty tiles are already transparent, so only the drawn ones are copied
+    for (QHash<int, QSharedDataPointer<Tile>>::const_iterator tile = tiles.constBegin(); tile != tiles.constEnd(); ++tile)
+    {
+        int left = (tile.key() % tileColumns)*Tile::SIZE;
+        int top = (tile.key() / tileColumns)*Tile::SIZE;
+        int count = std::min(Tile::SIZE, width - left);
+        int rows = std::min(Tile::SIZE, height - top);
+
+        for (int row = 0; row < rows; row++)
+        {
+            QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(top + row));
+            std::memcpy(line + left, tile.value()->pixels + row*Tile::SIZE, count*sizeof(QRgb));
+        }
+    }
+
+    return image;
+}
+
+void Layer::fromImage(const QImage& source)
+{
+    QImage image = source.convertToFormat(QImage::Format_ARGB32);
+    reset(image.width(), image.height());
+
+    // Copied a whole tile at a time, leaving out the ones with nothing on them
+    QRgb pixels[Tile::SIZE*Tile::SIZE];
+
+    for (int tileRow = 0; tileRow < tileRows; tileRow++)
+    {
+        for (int tileColumn = 0; tileColumn < tileColumns; tileColumn++)
+        {
+            int left = tileColumn*Tile::SIZE;
+            int top = tileRow*Tile::SIZE;
+            int count = std::min(Tile::SIZE, width - left);
+            int rows = std::min(Tile::SIZE, height - top);
+            bool isBlank = true;
+
+            std::fill(pixels, pixels + Tile::SIZE*Tile::SIZE, qRgba(0, 0, 0, 0));
+
+            for (int row = 0; row < rows; row++)
+            {
+                const QRgb* line = reinterpret_cast<const QRgb*>(image.constScanLine(top + row)) + left;
+                std::memcpy(pixels + row*Tile::SIZE, line, count*sizeof(QRgb));
+
+                for (int x = 0; x < count && isBlank; x++)
+                {
+                    isBlank = line[x] == qRgba(0, 0, 0, 0);
+                }
+            }
+
+            if (!isBlank)
+            {
+                setTilePixels(tileColumn, tileRow, pixels);
+            }
+        }
+    }
+}
+
+void Layer::changeResolution(int newWidth, int newHeight)
+{
+    if (newWidth < width || newHeight < height)
+    {
+        reset(newWidth, newHeight);
+    }
+    else if (newWidth > width || newHeight > height)
+    {
+        fromImage(toImage().scaled(newWidth, newHeight, Qt::IgnoreAspectRatio, Qt::FastTransformation));
+    }
+}
+
+void Layer::resize(int newWidth, int newHeight)
+{
+    QHash<int, QSharedDataPointer<Tile>> oldTiles = tiles;
+    int oldTileColumns = tileColumns;
+    reset(newWidth, newHeight);
+
+    for (QHash<int, QSharedDataPointer<Tile>>::const_iterator tile = oldTiles.constBegin(); tile != oldTiles.constEnd(); ++tile)
+    {
+        int tileColumn = tile.key() % oldTileColumns;
+        int tileRow = tile.key() / oldTileColumns;
+
+        if (tileColumn >= tileColumns || tileRow >= tileRows)
+        {
+            continue;
+        }
+
+        QSharedDataPointer<Tile>& kept = tiles[tileRow*tileColumns + tileColumn];
+        kept = tile.value();
+
+        // Pixels past the new edges have to read as transparent if the layer grows again
+        int visibleColumns = std::min(Tile::SIZE, width - tileColumn*Tile::SIZE);
+        int visibleRows = std::min(Tile::SIZE, height - tileRow*Tile::SIZE);
+
+        if (visibleColumns < Tile::SIZE || visibleRows < Tile::SIZE)
+        {
+            for (int row = 0; row < Tile::SIZE; row++)
+            {
+                int first = row < visibleRows ? visibleColumns : 0;
+                std::fill(kept->pixels + row*Tile::SIZE + first, kept->pixels + (row + 1)*Tile::SIZE, qRgba(0, 0, 0, 0));
+            }
+        }
+    }
+}
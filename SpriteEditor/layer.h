@@ -0,0 +1,159 @@
+#ifndef LAYER_H
+#define LAYER_H
+#include <QImage>
+#include <QColor>
+#include <QSize>
+#include <QRect>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QSharedData>
+#include <QSharedDataPointer>
+#include <algorithm>
+
+/**
+ * A square block of sprite pixels. Tiles are shared between a layer and its
+ * copies, and only copied the first time one of the copies writes to them.
+ */
+struct Tile : public QSharedData
+{
+    static const int SIZE = 16;
+
+    QRgb pixels[SIZE*SIZE];
+};
+
+/**
+ * One layer of a frame: its pixels, at sprite resolution, plus how it gets
+ * blended with the layers under it.
+ *
+ * Only tiles that have been drawn on take up memory, so a mostly empty
+ * 4096x4096 layer is as cheap as a small one. Copying a layer is O(1), and
+ * after that it only costs memory for the tiles that get drawn on.
+ */
+class Layer
+{
+private:
+    int width;
+    int height;
+    int tileColumns;
+    int tileRows;
+    QString name;
+    int opacity;
+    bool visible;
+
+    // Keyed by tileRow*tileColumns + tileColumn. Missing tiles are transparent.
+    QHash<int, QSharedDataPointer<Tile>> tiles;
+
+    int tileIndex(int x, int y) const;
+    void reset(int newWidth, int newHeight);
+
+public:
+    /**
+     *  Returns a new, fully transparent tile.
+     */
+    static QSharedDataPointer<Tile> createTile();
+
+    Layer(int width = 32, int height = 32, QString name = QString());
+
+    int getWidth() const;
+    int getHeight() const;
+    int getTileColumns() const;
+    int getTileRows() const;
+
+    QString getName() const;
+    void setName(QString name);
+
+    /**
+     *  How much of the layer shows through, from 0 to 255.
+     */
+    int getOpacity() const;
+    void setOpacity(int opacity);
+    bool isVisible() const;
+    void setVisible(bool visible);
+
+    /**
+     *  Returns how many tiles have been drawn on and take up memory.
+     */
+    int getAllocatedTileCount() const;
+
+    /**
+     *  Returns the tileRow*getTileColumns() + tileColumn index of every tile
+     *  that has been drawn on, in no particular order.
+     */
+    QList<int> getAllocatedTiles() const;
+
+    /**
+     *  Returns the Tile::SIZE x Tile::SIZE pixels of a tile, row by row, or nullptr if
+     *  nothing was ever drawn there. Pixels past the right and bottom edges of the
+     *  layer are always transparent.
+     */
+    const QRgb* getTilePixels(int tileColumn, int tileRow) const;
+
+    /**
+     *  Replaces a whole tile with Tile::SIZE x Tile::SIZE pixels, row by row.
+     *  Files and caches load tiles this way instead of pixel by pixel.
+     */
+    void setTilePixels(int tileColumn, int tileRow, const QRgb* pixels);
+
+    /**
+     *  Makes a tile the same as that tile of other, which must be the same size,
+     *  by sharing it rather than copying its pixels. The copy happens when either
+     *  layer next draws on it.
+     */
+    void shareTile(const Layer& other, int tileColumn, int tileRow);
+
+    QRgb getPixelRgb(int x, int y) const;
+    void setPixelRgb(int x, int y, QRgb rgb);
+
+    /**
+     *  Replaces the 4-connected area of pixels the same color as x, y with rgb,
+     *  one horizontal span at a time. Pixels are read and written a tile row at
+     *  a time, never one by one through the tile lookup. Returns the bounding
+     *  box of the pixels that changed.
+     */
+    QRect floodFill(int x, int y, QRgb rgb);
+
+    /**
+     *  Returns the pixels inside area as an ARGB32 image, copied a tile row at a
+     *  time. Parts of area outside the layer come out transparent.
+     */
+    QImage copyArea(QRect area) const;
+
+    /**
+     *  Overwrites the pixels under image, placed with its top left corner at
+     *  topLeft, a tile row at a time. Parts outside the layer are cut off.
+     */
+    void pasteImage(QPoint topLeft, const QImage& image);
+
+    /**
+     *  Makes every pixel inside area transparent. Tiles area covers completely
+     *  are dropped rather than cleared.
+     */
+    void clearArea(QRect area);
+
+    /**
+     *  Flattens the tiles into a single ARGB32 image the size of the layer.
+     */
+    QImage toImage() const;
+
+    /**
+     *  Replaces the pixels with those of image, resizing the layer to match.
+     */
+    void fromImage(const QImage& image);
+
+    /*
+      changes the sprite resolution of the layer. Going to a finer resolution keeps the drawing
+      by turning every old pixel into a block of new ones, going coarser clears the layer.
+     */
+    void changeResolution(int newWidth, int newHeight);
+
+    /**
+     *  Changes the size of the layer without scaling. The drawing stays anchored to
+     *  the top left corner, anything past the new edges is cut off.
+     */
+    void resize(int newWidth, int newHeight);
+};
+
+Q_DECLARE_TYPEINFO(Layer, Q_MOVABLE_TYPE);
+
+#endif // LAYER_H
@@ -0,0 +1,123 @@
+#include "layerpanel.h"
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QSignalBlocker>
+
+LayerPanel::LayerPanel(QWidget *parent) :
+    QWidget(parent)
+{
+    frame = nullptr;
+    layerCount = 0;
+
+    layerList = new QListWidget(this);
+    addButton = new QPushButton("+", this);
+    removeButton = new QPushButton("-", this);
+    upButton = new QPushButton("Up", this);
+    downButton = new QPushButton("Down", this);
+
+    // Only report the opacity once the slider is let go, so a drag is one undo step
+    opacitySlider = new QSlider(Qt::Horizontal, this);
+    opacitySlider->setRange(0, 255);
+    opacitySlider->setTracking(false);
+
+    QHBoxLayout* buttons = new QHBoxLayout();
+    buttons->addWidget(addButton);
+    buttons->addWidget(removeButton);
+    buttons->addWidget(upButton);
+    buttons->addWidget(downButton);
+
+    QHBoxLayout* opacity = new QHBoxLayout();
+    opacity->addWidget(new QLabel("Opacity", this));
+    opacity->addWidget(opacitySlider);
+
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->addWidget(layerList);
+    layout->addLayout(buttons);
+    layout->addLayout(opacity);
+
+    QObject::connect(addButton, &QPushButton::pressed,
+                    this, &LayerPanel::layerAdded);
+    QObject::connect(removeButton, &QPushButton::pressed,
+                    [=]() {emit layerRemoved(currentLayer());});
+    QObject::connect(upButton, &QPushButton::pressed,
+                    [=]() {emit layerMoved(currentLayer(), currentLayer() + 1);});
+    QObject::connect(downButton, &QPushButton::pressed,
+                    [=]() {emit layerMoved(currentLayer(), currentLayer() - 1);});
+    QObject::connect(opacitySlider, &QSlider::valueChanged,
+                    [=](int value) {emit layerOpacityChanged(currentLayer(), value);});
+    QObject::connect(layerList, &QListWidget::currentRowChanged,
+                    this, &LayerPanel::handleRowChanged);
+    QObject::connect(layerList, &QListWidget::itemChanged,
+                    this, &LayerPanel::handleItemChanged);
+}
+
+void LayerPanel::showLayers(const Frame* frame)
+{
+    this->frame = frame;
+    if (frame == nullptr)
+    {
+        return;
+    }
+
+    // Filling in the list shouldn't read as the user changing it
+    QSignalBlocker blockList(layerList);
+    QSignalBlocker blockSlider(opacitySlider);
+
+    layerCount = frame->getLayerCount();
+    layerList->clear();
+
+    for (int index = layerCount - 1; index >= 0; index--)
+    {
+        const Layer& layer = frame->getLayer(index);
+        QListWidgetItem* item = new QListWidgetItem(layer.getName(), layerList);
+        item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
+        item->setCheckState(layer.isVisible() ? Qt::Checked : Qt::Unchecked);
+    }
+
+    int current = frame->getCurrentLayerIndex();
+    layerList->setCurrentRow(layerCount - 1 - current);
+    opacitySlider->setValue(frame->getLayer(current).getOpacity());
+    updateButtonsToDisable();
+}
+
+int LayerPanel::rowToLayer(int row)
+{
+    return layerCount - 1 - row;
+}
+
+int LayerPanel::currentLayer()
+{
+    return rowToLayer(layerList->currentRow());
+}
+
+void LayerPanel::updateButtonsToDisable()
+{
+    int current = currentLayer();
+
+    removeButton->setDisabled(layerCount <= 1);
+    upButton->setDisabled(current >= layerCount - 1);
+    downButton->setDisabled(current <= 0);
+}
+
+void LayerPanel::handleRowChanged(int row)
+{
+    if (row < 0)
+    {
+        return;
+    }
+
+    if (frame != nullptr)
+    {
+        QSignalBlocker blockSlider(opacitySlider);
+        opacitySlider->setValue(frame->getLayer(rowToLayer(row)).getOpacity());
+    }
+
+    updateButtonsToDisable();
+    emit currentLayerChanged(rowToLayer(row));
+}
+
+void LayerPanel::handleItemChanged(QListWidgetItem* item)
+{
+    emit layerVisibilityChanged(rowToLayer(layerList->row(item)), item->checkState() == Qt::Checked);
+}
@@ -0,0 +1,58 @@
+#ifndef LAYERPANEL_H
+#define LAYERPANEL_H
+
+#include <QWidget>
+#include <QListWidget>
+#include <QPushButton>
+#include <QSlider>
+#include "frame.h"
+
+/**
+ * Lists the layers of the current frame, top layer first, with controls to add,
+ * remove, reorder, hide and fade them. The panel only asks for changes through
+ * its signals, the model makes them and hands back the frame to show.
+ *
+ * Layer indexes in the signals count from the bottom of the stack, like Frame's.
+ */
+class LayerPanel : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit LayerPanel(QWidget *parent = nullptr);
+
+signals:
+    void layerAdded();
+    void layerRemoved(int index);
+    void layerMoved(int from, int to);
+    void currentLayerChanged(int index);
+    void layerOpacityChanged(int index, int opacity);
+    void layerVisibilityChanged(int index, bool visible);
+
+public slots:
+    /**
+     *  Refreshes the list to show the layers of frame. The frame belongs to the
+     *  model and must outlive its time on the panel.
+     */
+    void showLayers(const Frame* frame);
+
+private:
+    const Frame* frame;
+    QListWidget* layerList;
+    QPushButton* addButton;
+    QPushButton* removeButton;
+    QPushButton* upButton;
+    QPushButton* downButton;
+    QSlider* opacitySlider;
+    int layerCount;
+
+    int rowToLayer(int row);
+    int currentLayer();
+    void updateButtonsToDisable();
+
+private slots:
+    void handleRowChanged(int row);
+    void handleItemChanged(QListWidgetItem* item);
+};
+
+#endif // LAYERPANEL_H
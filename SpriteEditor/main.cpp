@@ -1,8 +1,16 @@
 #include "spriteeditorwindow.h"
+#include "batchexport.h"
 #include <QApplication>
 
 int main(int argc, char *argv[])
 {
+    // Exports from the command line run without a display, so they don't start the GUI
+    if (BatchExport::isRequested(argc, argv))
+    {
+        QCoreApplication app(argc, argv);
+        return BatchExport::run(app.arguments());
+    }
+
     QApplication a(argc, argv);
     SpriteModel *m = new SpriteModel();
     SpriteEditorWindow w(nullptr, m);
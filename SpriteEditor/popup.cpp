@@ -7,6 +7,7 @@ Popup::Popup(QWidget *parent) :
 {
     ui->setupUi(this);
     frameIndex = 0;
+    frames = nullptr;
     popupOpen = false;
     fpsTimer = new QTimer(this);
 
@@ -19,7 +20,7 @@ void Popup::start()
     fpsTimer->start(1000/fps);
 }
 
-void Popup::setFrames(QList<Frame*> frameList)
+void Popup::setFrames(const QVector<Frame>* frameList)
 {
     frames = frameList;
 }
@@ -37,9 +38,23 @@ void Popup::setFps(int newFps)
 
 void Popup::updateImage()
 {
-    if (popupOpen == true)
+    if (popupOpen == true && frames != nullptr && !frames->isEmpty())
     {
-        QPixmap current = QPixmap::fromImage(frames[frameIndex]->getImage());
+        // Frames may have been removed since the last tick
+        if (frameIndex >= frames->size())
+        {
+            frameIndex = 0;
+        }
+
+        // Frames are stored at sprite resolution, blow them up to fill the label
+        const Frame& frame = frames->at(frameIndex);
+        QSize imageSize = frame.getSize().scaled(ui->imageLabel->size(), Qt::KeepAspectRatio);
+        if (imageSize.isEmpty())
+        {
+            return;
+        }
+        QImage image = frame.toScaledImage(imageSize);
+        QPixmap current = QPixmap::fromImage(image);
         ui->imageLabel->setPixmap(current);
         ui->imageLabel->show();
         incrementFrameIndex();
@@ -49,7 +64,7 @@ void Popup::updateImage()
 
 void Popup::incrementFrameIndex()
 {
-    if (frameIndex < frames.size() - 1) // if this is not the last image in the sequence
+    if (frameIndex < frames->size() - 1) // if this is not the last image in the sequence
     {
         frameIndex++;
     }
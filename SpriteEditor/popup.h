@@ -14,11 +14,11 @@ class Popup : public QWidget
     Q_OBJECT
 
 public:
-    QList<Frame*> frames;
+    const QVector<Frame>* frames;
     bool popupOpen;
     explicit Popup(QWidget *parent = nullptr);
     ~Popup();
-    void setFrames(QList<Frame*> frameList);
+    void setFrames(const QVector<Frame>* frameList);
     void start();
 
 public slots:
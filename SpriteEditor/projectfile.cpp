@@ -0,0 +1,1064 @@
+#include "projectfile.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <QMutexLocker>
+#include <QtConcurrent>
+#include <QStringList>
+#include <QtEndian>
+#include <cstring>
+#include <climits>
+
+const quint16 ProjectFile::VERSION;
+const quint16 ProjectFile::HEADER_SIZE;
+const quint8 ProjectFile::KEY_FRAME;
+const quint8 ProjectFile::DELTA_FRAME;
+const quint8 ProjectFile::RAW_TILE;
+const quint8 ProjectFile::PACKED_TILE;
+const quint8 ProjectFile::SAME_TILE;
+const quint8 ProjectFile::XOR_TILE;
+const int ProjectFile::KEYFRAME_INTERVAL;
+const int ProjectSource::CACHE_SIZE;
+
+namespace
+{
+    const char MAGIC[4] = { 'S', 'S', 'P', 'B' };
+
+    // Runs in a packed tile are at most this long, so a length fits in a byte
+    const int MAX_RUN = 256;
+
+    /**
+     * Appends little endian numbers to a byte array.
+     */
+    class ByteWriter
+    {
+    public:
+        explicit ByteWriter(QByteArray& bytes) : bytes(bytes) {}
+
+        template <typename T>
+        void write(T value)
+        {
+            T littleEndian = qToLittleEndian(value);
+            bytes.append(reinterpret_cast<const char*>(&littleEndian), sizeof(T));
+        }
+
+        void write(const QByteArray& data)
+        {
+            bytes.append(data);
+        }
+
+        void writePixels(const QRgb* pixels, int count)
+        {
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+            bytes.append(reinterpret_cast<const char*>(pixels), count*int(sizeof(QRgb)));
+#else
+            for (int i = 0; i < count; i++)
+            {
+                write<quint32>(pixels[i]);
+            }
+#endif
+        }
+
+    private:
+        QByteArray& bytes;
+    };
+
+    /**
+     * Reads little endian numbers out of a block of memory, refusing to read
+     * past its end. Once a read fails every later one does too.
+     */
+    class ByteReader
+    {
+    public:
+        ByteReader(const char* data, qint64 size) : data(data), size(size), position(0), failed(false) {}
+
+        template <typename T>
+        T read()
+        {
+            if (!canRead(sizeof(T)))
+            {
+                return T(0);
+            }
+
+            T value = qFromLittleEndian<T>(reinterpret_cast<const uchar*>(data + position));
+            position += sizeof(T);
+            return value;
+        }
+
+        const char* readBytes(qint64 count)
+        {
+            if (!canRead(count))
+            {
+                return nullptr;
+            }
+
+            const char* bytes = data + position;
+            position += count;
+            return bytes;
+        }
+
+        bool readPixels(QRgb* pixels, int count)
+        {
+            const char* bytes = readBytes(qint64(count)*sizeof(QRgb));
+            if (bytes == nullptr)
+            {
+                return false;
+            }
+
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+            std::memcpy(pixels, bytes, count*sizeof(QRgb));
+#else
+            for (int i = 0; i < count; i++)
+            {
+                pixels[i] = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(bytes) + i*4);
+            }
+#endif
+            return true;
+        }
+
+        bool hasFailed() const
+        {
+            return failed;
+        }
+
+    private:
+        const char* data;
+        qint64 size;
+        qint64 position;
+        bool failed;
+
+        bool canRead(qint64 count)
+        {
+            if (failed || count < 0 || count > size - position)
+            {
+                failed = true;
+                return false;
+            }
+            return true;
+        }
+    };
+
+    void setError(QString* error, const QString& message)
+    {
+        if (error != nullptr)
+        {
+            *error = message;
+        }
+    }
+
+    /**
+     *  Counts the runs of equal pixels in a tile, as packTile would write them.
+     */
+    int countRuns(const QRgb* pixels)
+    {
+        int runs = 0;
+        for (int i = 0; i < Tile::SIZE*Tile::SIZE; runs++)
+        {
+            int length = 1;
+            while (i + length < Tile::SIZE*Tile::SIZE && length < MAX_RUN && pixels[i + length] == pixels[i])
+            {
+                length++;
+            }
+            i += length;
+        }
+        return runs;
+    }
+
+    void packTile(ByteWriter& writer, const QRgb* pixels, int runs)
+    {
+        writer.write<quint16>(quint16(runs));
+
+        for (int i = 0; i < Tile::SIZE*Tile::SIZE;)
+        {
+            int length = 1;
+            while (i + length < Tile::SIZE*Tile::SIZE && length < MAX_RUN && pixels[i + length] == pixels[i])
+            {
+                length++;
+            }
+
+            writer.write<quint8>(quint8(length - 1));
+            writer.write<quint32>(pixels[i]);
+            i += length;
+        }
+    }
+
+    bool unpackTile(ByteReader& reader, QRgb* pixels)
+    {
+        int runs = reader.read<quint16>();
+        int filled = 0;
+
+        for (int run = 0; run < runs && !reader.hasFailed(); run++)
+        {
+            int length = reader.read<quint8>() + 1;
+            QRgb pixel = reader.read<quint32>();
+
+            if (filled + length > Tile::SIZE*Tile::SIZE)
+            {
+                return false;
+            }
+
+            std::fill(pixels + filled, pixels + filled + length, pixel);
+            filled += length;
+        }
+
+        return !reader.hasFailed() && filled == Tile::SIZE*Tile::SIZE;
+    }
+
+    /**
+     * Reads the numbers out of an old text project in place, without making a
+     * string for every line or value, and keeps track of the line and column it's
+     * at so a malformed file can say where.
+     */
+    class TextScanner
+    {
+    public:
+        TextScanner(const char* data, qint64 size, int lineNumber) :
+            data(data), size(size), position(0), lineStart(0), lineNumber(lineNumber) {}
+
+        /**
+         *  Reads the next number on the current line, which must be from minimum
+         *  to maximum. Returns false and sets the error otherwise.
+         */
+        bool readNumber(int minimum, int maximum, int& value)
+        {
+            skipSpaces();
+
+            qint64 start = position;
+            qint64 number = 0;
+            while (position < size && data[position] >= '0' && data[position] <= '9')
+            {
+                number = number*10 + (data[position] - '0');
+                position++;
+
+                if (number > maximum)
+                {
+                    break;
+                }
+            }
+
+            bool isSeparated = position == size || isSpace(data[position]) || data[position] == '\n';
+            if (position == start || !isSeparated || number < minimum || number > maximum)
+            {
+                position = start;
+                return fail(QString("expected a number from %1 to %2").arg(minimum).arg(maximum));
+            }
+
+            value = int(number);
+            return true;
+        }
+
+        /**
+         *  Moves to the start of the next line. Returns false and sets the error
+         *  if there's anything but spaces left on this one.
+         */
+        bool endLine()
+        {
+            skipSpaces();
+
+            if (position < size && data[position] != '\n')
+            {
+                return fail("expected the end of the line");
+            }
+
+            if (position < size)
+            {
+                position++;
+            }
+            lineStart = position;
+            lineNumber++;
+            return true;
+        }
+
+        /**
+         *  Moves past count lines without reading them. Returns false if the text
+         *  runs out first.
+         */
+        bool skipLines(int count)
+        {
+            for (int line = 0; line < count; line++)
+            {
+                if (position >= size)
+                {
+                    return false;
+                }
+
+                const char* end = static_cast<const char*>(std::memchr(data + position, '\n', size_t(size - position)));
+                position = end == nullptr ? size : end - data + 1;
+                lineStart = position;
+                lineNumber++;
+            }
+            return true;
+        }
+
+        qint64 getPosition() const
+        {
+            return position;
+        }
+
+        int getLineNumber() const
+        {
+            return lineNumber;
+        }
+
+        QString getError() const
+        {
+            return error;
+        }
+
+    private:
+        const char* data;
+        qint64 size;
+        qint64 position;
+        qint64 lineStart;
+        int lineNumber;
+        QString error;
+
+        static bool isSpace(char character)
+        {
+            return character == ' ' || character == '\t' || character == '\r';
+        }
+
+        void skipSpaces()
+        {
+            while (position < size && isSpace(data[position]))
+            {
+                position++;
+            }
+        }
+
+        bool fail(const QString& message)
+        {
+            error = QString("Line %1, column %2: %3.").arg(lineNumber).arg(int(position - lineStart + 1)).arg(message);
+            return false;
+        }
+    };
+
+    /**
+     * One frame of an old text project, found but not yet parsed.
+     */
+    struct LegacyFrame
+    {
+        const char* data;
+        qint64 size;
+        int firstLine;
+        int width;
+        int height;
+        Frame frame;
+        QString error;
+    };
+
+    void parseLegacyFrame(LegacyFrame& legacy)
+    {
+        TextScanner scanner(legacy.data, legacy.size, legacy.firstLine);
+
+        // Parsed into an image first so the frame can be filled a tile at a time
+        QImage image(legacy.width, legacy.height, QImage::Format_ARGB32);
+        int channels[4];
+
+        // Each line holds one column of the sprite, as "r g b a " for every pixel down it
+        for (int x = 0; x < legacy.width; x++)
+        {
+            for (int y = 0; y < legacy.height; y++)
+            {
+                for (int channel = 0; channel < 4; channel++)
+                {
+                    if (!scanner.readNumber(0, 255, channels[channel]))
+                    {
+                        legacy.error = scanner.getError();
+                        return;
+                    }
+                }
+
+                reinterpret_cast<QRgb*>(image.scanLine(y))[x] = qRgba(channels[0], channels[1], channels[2], channels[3]);
+            }
+
+            if (!scanner.endLine())
+            {
+                legacy.error = scanner.getError();
+                return;
+            }
+        }
+
+        legacy.frame.fromImage(image);
+    }
+}
+
+ProjectSource::ProjectSource(const QString& fileName) :
+    file(new QFile(fileName)), data(nullptr), size(0), version(ProjectFile::VERSION)
+{
+
+}
+
+ProjectSource::ProjectSource(const QByteArray& bytes) :
+    data(bytes.constData()), size(bytes.size()), copy(bytes), version(ProjectFile::VERSION)
+{
+    addChunk(0, size);
+}
+
+ProjectSource::~ProjectSource()
+{
+    // Closing the file unmaps it
+    if (file)
+    {
+        file->close();
+    }
+}
+
+bool ProjectSource::open(QString* error)
+{
+    if (!file)
+    {
+        return true;
+    }
+
+    if (!file->open(QIODevice::ReadOnly))
+    {
+        setError(error, file->errorString());
+        return false;
+    }
+
+    size = file->size();
+    data = reinterpret_cast<const char*>(file->map(0, size));
+
+    // Some file systems can't be mapped, those files are read in whole instead
+    if (data == nullptr)
+    {
+        release();
+        if (copy.size() != size)
+        {
+            setError(error, file->errorString());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+QString ProjectSource::getFileName() const
+{
+    return file ? file->fileName() : QString();
+}
+
+const char* ProjectSource::getData() const
+{
+    return data;
+}
+
+qint64 ProjectSource::getSize() const
+{
+    return size;
+}
+
+quint16 ProjectSource::getVersion() const
+{
+    return version;
+}
+
+void ProjectSource::setVersion(quint16 version)
+{
+    this->version = version;
+}
+
+void ProjectSource::addChunk(qint64 offset, qint64 size)
+{
+    Chunk chunk;
+    chunk.offset = offset;
+    chunk.size = size;
+    chunks.append(chunk);
+
+    int reference = getReference(chunks.size() - 1);
+    referenced.append(false);
+    if (reference >= 0)
+    {
+        referenced[reference] = true;
+    }
+}
+
+int ProjectSource::getChunkCount() const
+{
+    return chunks.size();
+}
+
+QByteArray ProjectSource::getChunk(int index) const
+{
+    return QByteArray(data + chunks[index].offset, int(chunks[index].size));
+}
+
+int ProjectSource::getReference(int index) const
+{
+    int reference = ProjectFile::readReference(data + chunks[index].offset, chunks[index].size, version);
+
+    // Only pointing back keeps a corrupt file from sending decode() round in circles
+    return reference < index ? reference : -2;
+}
+
+bool ProjectSource::decode(int index, int width, int height, QVector<Layer>& layers, int& currentLayerIndex)
+{
+    // Walks back along the deltas to a keyframe or a chunk still in the cache, then
+    // decodes forwards. Files are saved with a keyframe at least every
+    // KEYFRAME_INTERVAL chunks, so a longer chain means a damaged file, and
+    // following it would only decode the same chunks over and over.
+    QVector<int> chain;
+    QVector<Layer> decodedLayers;
+    int decodedLayerIndex = 0;
+    bool fromCache = false;
+
+    for (int link = index;;)
+    {
+        {
+            QMutexLocker locker(&cacheMutex);
+            for (int i = 0; i < cache.size(); i++)
+            {
+                if (cache[i].index == link)
+                {
+                    decodedLayers = cache[i].layers;
+                    decodedLayerIndex = cache[i].currentLayerIndex;
+                    cache.move(i, 0);
+                    fromCache = true;
+                    break;
+                }
+            }
+        }
+
+        if (fromCache)
+        {
+            break;
+        }
+
+        chain.append(link);
+        int reference = getReference(link);
+        if (reference == -2 || chain.size() > ProjectFile::KEYFRAME_INTERVAL)
+        {
+            return false;
+        }
+
+        if (reference == -1)
+        {
+            break;
+        }
+
+        link = reference;
+    }
+
+    // Not holding the lock while decoding lets other threads decode other chunks, at
+    // the cost of sometimes decoding the same one twice
+    for (int i = chain.size() - 1; i >= 0; i--)
+    {
+        bool isKeyframe = i == chain.size() - 1 && !fromCache;
+
+        DecodedChunk decoded;
+        decoded.index = chain[i];
+        if (!ProjectFile::decodeFrame(data + chunks[decoded.index].offset, chunks[decoded.index].size, version,
+                                      width, height, isKeyframe ? nullptr : &decodedLayers, decoded.layers,
+                                      decoded.currentLayerIndex))
+        {
+            return false;
+        }
+
+        decodedLayers = decoded.layers;
+        decodedLayerIndex = decoded.currentLayerIndex;
+
+        // A chunk no delta is encoded against is only ever decoded for its own
+        // frame, which keeps the layers while it needs them
+        if (!referenced[decoded.index])
+        {
+            continue;
+        }
+
+        QMutexLocker locker(&cacheMutex);
+        cache.prepend(decoded);
+        while (cache.size() > CACHE_SIZE)
+        {
+            cache.removeLast();
+        }
+    }
+
+    layers = decodedLayers;
+    currentLayerIndex = decodedLayerIndex;
+    return true;
+}
+
+void ProjectSource::release()
+{
+    if (!file || !file->isOpen())
+    {
+        return;
+    }
+
+    if (data != nullptr)
+    {
+        copy = QByteArray(data, int(size));
+    }
+    else
+    {
+        file->seek(0);
+        copy = file->readAll();
+    }
+
+    file->close();
+    data = copy.constData();
+}
+
+QByteArray ProjectFile::encodeFrame(const Frame& source, const Frame* reference, int referenceIndex)
+{
+    // Frames unchanged since they were opened or packed are saved as they were read,
+    // unless the chunk is a delta that would no longer follow the frame it's a delta of
+    QSharedPointer<ProjectSource> chunkSource = source.getSource();
+    if (chunkSource && chunkSource->getVersion() == VERSION)
+    {
+        int chunkReference = chunkSource->getReference(source.getChunkIndex());
+        bool isKeyframe = chunkReference == -1;
+        bool followsReference = chunkReference >= 0 && reference != nullptr && reference->getSource() == chunkSource
+                && reference->getChunkIndex() == chunkReference && chunkReference == referenceIndex;
+
+        if (isKeyframe || followsReference)
+        {
+            return chunkSource->getChunk(source.getChunkIndex());
+        }
+    }
+
+    Frame frame = source;
+    frame.anchorFloatingSelection();
+
+    // The reference is only ever read here, but reading decodes it, which mustn't stick
+    Frame referenceFrame;
+    bool isDelta = reference != nullptr && reference->getSize() == frame.getSize();
+    if (isDelta)
+    {
+        referenceFrame = *reference;
+        referenceFrame.anchorFloatingSelection();
+    }
+
+    QByteArray bytes;
+    bytes.reserve(frame.getAllocatedTileCount()*int(sizeof(Tile)) + 64);
+    ByteWriter writer(bytes);
+
+    writer.write<quint8>(isDelta ? DELTA_FRAME : KEY_FRAME);
+    writer.write<quint8>(0);
+    writer.write<quint16>(0);
+    writer.write<quint32>(isDelta ? quint32(referenceIndex) : 0);
+    writer.write<quint32>(quint32(frame.getLayerCount()));
+    writer.write<quint32>(quint32(frame.getCurrentLayerIndex()));
+
+    QRgb difference[Tile::SIZE*Tile::SIZE];
+
+    for (int layerIndex = 0; layerIndex < frame.getLayerCount(); layerIndex++)
+    {
+        const Layer& layer = frame.getLayer(layerIndex);
+        const Layer* referenceLayer = isDelta && layerIndex < referenceFrame.getLayerCount()
+                ? &referenceFrame.getLayer(layerIndex) : nullptr;
+        QByteArray name = layer.getName().toUtf8();
+
+        writer.write<quint32>(quint32(name.size()));
+        writer.write(name);
+        writer.write<quint8>(quint8(layer.getOpacity()));
+        writer.write<quint8>(layer.isVisible() ? 1 : 0);
+        writer.write<quint16>(0);
+
+        QList<int> tiles = layer.getAllocatedTiles();
+        writer.write<quint32>(quint32(tiles.size()));
+
+        for (int index : tiles)
+        {
+            int tileColumn = index % layer.getTileColumns();
+            int tileRow = index / layer.getTileColumns();
+            const QRgb* pixels = layer.getTilePixels(tileColumn, tileRow);
+            const QRgb* referencePixels = referenceLayer == nullptr ? nullptr : referenceLayer->getTilePixels(tileColumn, tileRow);
+            writer.write<quint32>(quint32(index));
+
+            // Tiles nothing was drawn on since the reference are often still shared with it
+            if (referencePixels != nullptr && (referencePixels == pixels || std::memcmp(referencePixels, pixels, sizeof(Tile::pixels)) == 0))
+            {
+                writer.write<quint8>(SAME_TILE);
+                continue;
+            }
+
+            // Packed runs cost 5 bytes, so they only pay off for tiles with few of them
+            int runs = countRuns(pixels);
+            int packedSize = std::min(runs*5 + 2, int(sizeof(Tile::pixels)));
+
+            if (referencePixels != nullptr)
+            {
+                for (int i = 0; i < Tile::SIZE*Tile::SIZE; i++)
+                {
+                    difference[i] = pixels[i] ^ referencePixels[i];
+                }
+
+                int differenceRuns = countRuns(difference);
+                if (differenceRuns*5 + 2 < packedSize)
+                {
+                    writer.write<quint8>(XOR_TILE);
+                    packTile(writer, difference, differenceRuns);
+                    continue;
+                }
+            }
+
+            if (runs*5 + 2 < int(sizeof(Tile::pixels)))
+            {
+                writer.write<quint8>(PACKED_TILE);
+                packTile(writer, pixels, runs);
+            }
+            else
+            {
+                writer.write<quint8>(RAW_TILE);
+                writer.writePixels(pixels, Tile::SIZE*Tile::SIZE);
+            }
+        }
+    }
+
+    return bytes;
+}
+
+int ProjectFile::readReference(const char* data, qint64 size, quint16 version)
+{
+    if (version < 3)
+    {
+        return -1;
+    }
+
+    ByteReader reader(data, size);
+    quint8 type = reader.read<quint8>();
+    reader.read<quint8>();
+    reader.read<quint16>();
+    quint32 reference = reader.read<quint32>();
+
+    if (reader.hasFailed() || (type != KEY_FRAME && type != DELTA_FRAME) || reference > quint32(INT_MAX))
+    {
+        return -2;
+    }
+
+    return type == KEY_FRAME ? -1 : int(reference);
+}
+
+bool ProjectFile::decodeFrame(const char* data, qint64 size, quint16 version, int width, int height,
+                              const QVector<Layer>* reference, QVector<Layer>& layers, int& currentLayerIndex)
+{
+    ByteReader reader(data, size);
+
+    // The frame type and reference were already read by whoever found the reference
+    if (version >= 3)
+    {
+        reader.readBytes(8);
+    }
+
+    quint32 layerCount = reader.read<quint32>();
+    quint32 currentLayer = reader.read<quint32>();
+
+    // Every layer takes at least 12 bytes, which bounds what a corrupt count can allocate
+    if (reader.hasFailed() || layerCount == 0 || layerCount > quint64(size)/12)
+    {
+        return false;
+    }
+
+    QVector<Layer> decoded;
+    decoded.reserve(int(layerCount));
+    int tileColumns = (width + Tile::SIZE - 1)/Tile::SIZE;
+    int tileCount = tileColumns*((height + Tile::SIZE - 1)/Tile::SIZE);
+    QRgb pixels[Tile::SIZE*Tile::SIZE];
+
+    for (quint32 layerIndex = 0; layerIndex < layerCount; layerIndex++)
+    {
+        quint32 nameLength = reader.read<quint32>();
+        const char* name = reader.readBytes(nameLength);
+        if (name == nullptr)
+        {
+            return false;
+        }
+
+        Layer layer(width, height, QString::fromUtf8(name, int(nameLength)));
+        layer.setOpacity(reader.read<quint8>());
+        layer.setVisible(reader.read<quint8>() != 0);
+        reader.read<quint16>();
+
+        const Layer* referenceLayer = reference != nullptr && int(layerIndex) < reference->size()
+                ? &reference->at(int(layerIndex)) : nullptr;
+
+        quint32 tiles = reader.read<quint32>();
+        for (quint32 tile = 0; tile < tiles && !reader.hasFailed(); tile++)
+        {
+            quint32 index = reader.read<quint32>();
+            quint8 encoding = reader.read<quint8>();
+
+            if (index >= quint32(tileCount))
+            {
+                return false;
+            }
+
+            int tileColumn = int(index) % tileColumns;
+            int tileRow = int(index) / tileColumns;
+            const QRgb* referencePixels = referenceLayer == nullptr ? nullptr : referenceLayer->getTilePixels(tileColumn, tileRow);
+
+            bool isRead = false;
+            if (encoding == RAW_TILE)
+            {
+                isRead = reader.readPixels(pixels, Tile::SIZE*Tile::SIZE);
+            }
+            else if (encoding == PACKED_TILE)
+            {
+                isRead = unpackTile(reader, pixels);
+            }
+            else if (encoding == SAME_TILE && referencePixels != nullptr)
+            {
+                // Shared, so a run of frames that barely change costs barely more than one
+                layer.shareTile(*referenceLayer, tileColumn, tileRow);
+                continue;
+            }
+            else if (encoding == XOR_TILE && referencePixels != nullptr && unpackTile(reader, pixels))
+            {
+                for (int i = 0; i < Tile::SIZE*Tile::SIZE; i++)
+                {
+                    pixels[i] ^= referencePixels[i];
+                }
+                isRead = true;
+            }
+
+            if (!isRead)
+            {
+                return false;
+            }
+
+            layer.setTilePixels(tileColumn, tileRow, pixels);
+        }
+
+        if (reader.hasFailed())
+        {
+            return false;
+        }
+        decoded.append(layer);
+    }
+
+    layers = decoded;
+    currentLayerIndex = int(std::min(currentLayer, layerCount - 1));
+    return true;
+}
+
+void ProjectFile::releaseSources(const QString& fileName, const QVector<Frame>& frames)
+{
+    QString canonicalName = QFileInfo(fileName).canonicalFilePath();
+    QSet<ProjectSource*> released;
+
+    for (const Frame& frame : frames)
+    {
+        QSharedPointer<ProjectSource> source = frame.getSource();
+
+        if (source && !released.contains(source.data()) && !canonicalName.isEmpty()
+                && QFileInfo(source->getFileName()).canonicalFilePath() == canonicalName)
+        {
+            source->release();
+            released.insert(source.data());
+        }
+    }
+}
+
+bool ProjectFile::save(const QString& fileName, const QVector<Frame>& frames, QString* error, bool deltaFrames,
+                       const Progress& progress)
+{
+    if (frames.isEmpty())
+    {
+        setError(error, "There are no frames to save.");
+        return false;
+    }
+
+    // Frames opened from the file being overwritten still read their pixels out of it,
+    // so it gets copied into memory before it's replaced
+    releaseSources(fileName, frames);
+
+    // Written next to fileName and moved over it once complete, so a failed or
+    // interrupted save leaves the old file as it was
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        setError(error, file.errorString());
+        return false;
+    }
+
+    QByteArray header;
+    ByteWriter writer(header);
+    header.append(MAGIC, sizeof(MAGIC));
+    writer.write<quint16>(VERSION);
+    writer.write<quint16>(HEADER_SIZE);
+    writer.write<quint32>(quint32(frames[0].getWidth()));
+    writer.write<quint32>(quint32(frames[0].getHeight()));
+    writer.write<quint32>(quint32(frames.size()));
+    writer.write<quint32>(0);
+
+    // The index comes before the chunks it points at, so it's filled in as they're written
+    qint64 indexSize = qint64(frames.size())*2*sizeof(quint64);
+    qint64 offset = HEADER_SIZE + indexSize;
+    QByteArray index;
+    index.reserve(int(indexSize));
+    ByteWriter indexWriter(index);
+
+    if (file.write(header) != header.size() || !file.seek(offset))
+    {
+        setError(error, file.errorString());
+        return false;
+    }
+
+    for (int frameIndex = 0; frameIndex < frames.size(); frameIndex++)
+    {
+        // Stopping before the commit leaves the old file in place
+        if (progress && !progress(frameIndex))
+        {
+            setError(error, "Saving was canceled.");
+            return false;
+        }
+
+        bool isKeyframe = !deltaFrames || frameIndex % KEYFRAME_INTERVAL == 0;
+        QByteArray chunk = isKeyframe ? encodeFrame(frames[frameIndex])
+                                      : encodeFrame(frames[frameIndex], &frames[frameIndex - 1], frameIndex - 1);
+
+        if (file.write(chunk) != chunk.size())
+        {
+            setError(error, file.errorString());
+            return false;
+        }
+
+        indexWriter.write<quint64>(quint64(offset));
+        indexWriter.write<quint64>(quint64(chunk.size()));
+        offset += chunk.size();
+    }
+
+    if (!file.seek(HEADER_SIZE) || file.write(index) != index.size() || !file.commit())
+    {
+        setError(error, file.errorString());
+        return false;
+    }
+
+    return true;
+}
+
+bool ProjectFile::load(const QString& fileName, QVector<Frame>& frames, QString* error)
+{
+    QSharedPointer<ProjectSource> source(new ProjectSource(fileName));
+    if (!source->open(error))
+    {
+        return false;
+    }
+
+    if (source->getSize() >= qint64(sizeof(MAGIC)) && std::memcmp(source->getData(), MAGIC, sizeof(MAGIC)) == 0)
+    {
+        return loadBinary(source, frames, error);
+    }
+
+    // Old projects have no index to jump around with, so they're read in whole
+    return loadLegacy(source->getData(), source->getSize(), frames, error);
+}
+
+bool ProjectFile::loadBinary(const QSharedPointer<ProjectSource>& source, QVector<Frame>& frames, QString* error)
+{
+    qint64 fileSize = source->getSize();
+    ByteReader reader(source->getData() + sizeof(MAGIC), fileSize - qint64(sizeof(MAGIC)));
+    quint16 version = reader.read<quint16>();
+    quint16 headerSize = reader.read<quint16>();
+    quint32 width = reader.read<quint32>();
+    quint32 height = reader.read<quint32>();
+    quint32 frameCount = reader.read<quint32>();
+
+    if (reader.hasFailed() || fileSize < HEADER_SIZE)
+    {
+        setError(error, "The file is too short to be a sprite project.");
+        return false;
+    }
+    if (version != 2 && version != VERSION)
+    {
+        setError(error, QString("The file is version %1 of the project format, this editor reads version %2.")
+                 .arg(version).arg(VERSION));
+        return false;
+    }
+    if (width < 1 || height < 1 || width > quint32(Frame::MAX_SIZE) || height > quint32(Frame::MAX_SIZE)
+            || frameCount == 0 || headerSize < HEADER_SIZE)
+    {
+        setError(error, "The file's canvas size or frame count is invalid.");
+        return false;
+    }
+
+    qint64 indexSize = qint64(frameCount)*2*sizeof(quint64);
+    if (headerSize + indexSize > fileSize)
+    {
+        setError(error, "The file's frame index is cut off.");
+        return false;
+    }
+
+    // Only the index is read here. Each frame's pixels stay in the mapped file until
+    // something needs them, so opening costs the same however much is drawn.
+    ByteReader indexReader(source->getData() + headerSize, indexSize);
+    source->setVersion(version);
+    QVector<Frame> loaded;
+    loaded.reserve(int(frameCount));
+
+    for (quint32 frameIndex = 0; frameIndex < frameCount; frameIndex++)
+    {
+        quint64 offset = indexReader.read<quint64>();
+        quint64 size = indexReader.read<quint64>();
+
+        if (offset > quint64(fileSize) || size > quint64(fileSize) - offset || size == 0)
+        {
+            setError(error, QString("Frame %1 is outside the file.").arg(frameIndex + 1));
+            return false;
+        }
+
+        source->addChunk(qint64(offset), qint64(size));
+        loaded.append(Frame::fromChunk(source, int(frameIndex), int(width), int(height)));
+    }
+
+    frames = loaded;
+    return true;
+}
+
+bool ProjectFile::loadLegacy(const char* data, qint64 size, QVector<Frame>& frames, QString* error)
+{
+    TextScanner scanner(data, size, 1);
+    int width = 0;
+    int height = 0;
+    int numberOfFrames = 0;
+
+    if (!scanner.readNumber(1, Frame::MAX_SIZE, width) || !scanner.readNumber(1, Frame::MAX_SIZE, height)
+            || !scanner.endLine() || !scanner.readNumber(1, INT_MAX, numberOfFrames) || !scanner.endLine())
+    {
+        setError(error, "The file isn't a sprite project. " + scanner.getError());
+        return false;
+    }
+
+    // Finding the lines is quick next to parsing them, so that's done first and
+    // the frames are then parsed on every core at once
+    QVector<LegacyFrame> pending;
+
+    for (int frame = 0; frame < numberOfFrames; frame++)
+    {
+        LegacyFrame legacy;
+        legacy.data = data + scanner.getPosition();
+        legacy.firstLine = scanner.getLineNumber();
+        legacy.width = width;
+        legacy.height = height;
+
+        if (!scanner.skipLines(width))
+        {
+            setError(error, QString("Frame %1 is cut off at line %2.").arg(frame + 1).arg(scanner.getLineNumber()));
+            return false;
+        }
+
+        legacy.size = data + scanner.getPosition() - legacy.data;
+        pending.append(legacy);
+    }
+
+    QtConcurrent::blockingMap(pending, parseLegacyFrame);
+
+    QVector<Frame> loaded;
+    loaded.reserve(numberOfFrames);
+
+    for (int frame = 0; frame < pending.size(); frame++)
+    {
+        if (!pending[frame].error.isEmpty())
+        {
+            setError(error, QString("Frame %1 is malformed. %2").arg(frame + 1).arg(pending[frame].error));
+            return false;
+        }
+
+        loaded.append(pending[frame].frame);
+    }
+
+    frames = loaded;
+    return true;
+}
@@ -0,0 +1,213 @@
+#ifndef PROJECTFILE_H
+#define PROJECTFILE_H
+
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+#include <QFile>
+#include <QSharedPointer>
+#include <QScopedPointer>
+#include <QMutex>
+#include <QList>
+#include <functional>
+#include "frame.h"
+
+/**
+ * Encoded frame chunks for frames to decode when they're next needed. Either an
+ * opened project file, memory mapped and shared by every frame that came from it,
+ * or a single frame packed away in memory.
+ *
+ * Delta chunks can only be decoded on top of the chunk they were encoded
+ * against, so the last few decoded chunks that deltas are encoded against are
+ * cached. Stepping through an animation then decodes each delta on top of the
+ * cached one before it, rather than going back to the keyframe every time.
+ * Other chunks aren't cached, so packed frames don't stay decoded.
+ */
+class ProjectSource
+{
+public:
+    explicit ProjectSource(const QString& fileName);
+
+    /**
+     *  Holds bytes that are already in memory, it needs no opening.
+     */
+    explicit ProjectSource(const QByteArray& bytes);
+    ~ProjectSource();
+
+    bool open(QString* error);
+    QString getFileName() const;
+    const char* getData() const;
+    qint64 getSize() const;
+
+    /**
+     *  The project format version the chunks are in.
+     */
+    quint16 getVersion() const;
+    void setVersion(quint16 version);
+
+    /**
+     *  The frame chunks, in file order. Sources made from bytes hold one chunk,
+     *  all of the bytes. Chunks are added once the data is open and the version set.
+     */
+    void addChunk(qint64 offset, qint64 size);
+    int getChunkCount() const;
+    QByteArray getChunk(int index) const;
+
+    /**
+     *  Returns the index of the chunk a delta chunk was encoded against, or -1
+     *  for a keyframe.
+     */
+    int getReference(int index) const;
+
+    /**
+     *  Decodes the layers of chunk index for a width x height canvas, and the
+     *  chunks it's a delta of first. Safe to call from several threads at once.
+     *  Returns false if a chunk is malformed, or if it's more than
+     *  ProjectFile::KEYFRAME_INTERVAL chunks from a keyframe, which no saved file is.
+     */
+    bool decode(int index, int width, int height, QVector<Layer>& layers, int& currentLayerIndex);
+
+    /**
+     *  Copies the file into memory and closes it, so it can be overwritten
+     *  without pulling the pixels out from under the frames still reading it.
+     */
+    void release();
+
+private:
+    Q_DISABLE_COPY(ProjectSource)
+
+    // Null for sources made from bytes
+    QScopedPointer<QFile> file;
+    const char* data;
+    qint64 size;
+    QByteArray copy;
+    quint16 version;
+
+    struct Chunk
+    {
+        qint64 offset;
+        qint64 size;
+    };
+    QVector<Chunk> chunks;
+
+    // Whether a delta chunk is encoded against each chunk, only those are cached
+    QVector<bool> referenced;
+
+    struct DecodedChunk
+    {
+        int index;
+        QVector<Layer> layers;
+        int currentLayerIndex;
+    };
+
+    // Most recently decoded first. Layers share their tiles, so these cost little
+    // beyond what the frames that were decoded hold anyway.
+    static const int CACHE_SIZE = 4;
+    QList<DecodedChunk> cache;
+    QMutex cacheMutex;
+};
+
+/**
+ * Reading and writing .ssp project files.
+ *
+ * Projects are saved in the binary version 3 format, all numbers little endian:
+ *
+ *   header       "SSPB", quint16 version, quint16 header size, quint32 width,
+ *                quint32 height, quint32 frame count, quint32 reserved
+ *   frame index  frame count x (quint64 offset, quint64 size) of each frame chunk
+ *   frame chunks quint8 KEY_FRAME or DELTA_FRAME, quint8 and quint16 reserved,
+ *                quint32 index of the earlier frame a delta is encoded against,
+ *                quint32 layer count, quint32 current layer, then per layer:
+ *                quint32 name length, UTF-8 name, quint8 opacity, quint8 visible,
+ *                quint16 reserved, quint32 tile count, then per drawn tile:
+ *                quint32 tile index, quint8 encoding and the tile's pixels,
+ *                either raw (RAW_TILE) or run length packed (PACKED_TILE). Delta
+ *                frames can also have tiles the same as the reference frame's
+ *                tile in the same layer (SAME_TILE), or packed as the XOR of the
+ *                two, which is mostly zeros (XOR_TILE)
+ *
+ * Version 2 is the same without the frame type and reference at the start of
+ * each chunk, and is still read.
+ *
+ * Only drawn tiles are stored, so files grow with what's drawn, not with the
+ * canvas size. The index lets a frame be found without reading the ones before it,
+ * so opening a project only reads the index and frames are decoded when first
+ * used, see Frame::fromChunk.
+ *
+ * The old text format (width and height, frame count, then one line of
+ * "r g b a " values per sprite column) is still read, and files in it are
+ * told apart by their first bytes.
+ */
+class ProjectFile
+{
+public:
+    static const quint16 VERSION = 3;
+    static const quint16 HEADER_SIZE = 24;
+    static const quint8 KEY_FRAME = 0;
+    static const quint8 DELTA_FRAME = 1;
+    static const quint8 RAW_TILE = 0;
+    static const quint8 PACKED_TILE = 1;
+    static const quint8 SAME_TILE = 2;
+    static const quint8 XOR_TILE = 3;
+
+    // With delta frames, every this many frames is saved whole so that getting to
+    // any frame decodes at most this many chunks
+    static const int KEYFRAME_INTERVAL = 16;
+
+    /**
+     *  Called with the number of frames done so far, returns false to stop.
+     */
+    typedef std::function<bool(int)> Progress;
+
+    /**
+     *  Saves frames to fileName in the current format. With deltaFrames, frames
+     *  between keyframes are saved as the difference from the frame before them.
+     *  Returns false and sets error if the file can't be written or progress
+     *  stops it, leaving the file that was there as it was.
+     */
+    static bool save(const QString& fileName, const QVector<Frame>& frames, QString* error = nullptr,
+                     bool deltaFrames = false, const Progress& progress = Progress());
+
+    /**
+     *  Copies the chunks of frames opened from fileName into memory, so the file
+     *  can be overwritten. save() does this itself, but it's not safe while
+     *  other copies of the frames are being read, so saving on another thread
+     *  needs it done first.
+     */
+    static void releaseSources(const QString& fileName, const QVector<Frame>& frames);
+
+    /**
+     *  Loads the frames in fileName, in either format, into frames. Returns false
+     *  and sets error, leaving frames alone, if the file can't be read. Frames
+     *  of version 2 files are left encoded until they're used.
+     */
+    static bool load(const QString& fileName, QVector<Frame>& frames, QString* error = nullptr);
+
+    /**
+     *  Encodes one frame as a frame chunk, a keyframe or, given a reference, the
+     *  delta from the reference frame saved at referenceIndex. A floating
+     *  selection is saved anchored. The chunks of frames unchanged since they
+     *  were opened are copied, if they still fit where they're going.
+     */
+    static QByteArray encodeFrame(const Frame& frame, const Frame* reference = nullptr, int referenceIndex = 0);
+
+    /**
+     *  Returns the index of the frame a chunk is a delta of, -1 if it's a
+     *  keyframe, or -2 if it's malformed.
+     */
+    static int readReference(const char* data, qint64 size, quint16 version);
+
+    /**
+     *  Decodes the layers of a frame chunk for a width x height canvas. Delta
+     *  chunks need the decoded layers of their reference frame. Returns false if
+     *  the chunk is malformed.
+     */
+    static bool decodeFrame(const char* data, qint64 size, quint16 version, int width, int height,
+                            const QVector<Layer>* reference, QVector<Layer>& layers, int& currentLayerIndex);
+
+private:
+    static bool loadBinary(const QSharedPointer<ProjectSource>& source, QVector<Frame>& frames, QString* error);
+    static bool loadLegacy(const char* data, qint64 size, QVector<Frame>& frames, QString* error);
+};
+
+#endif // PROJECTFILE_H
@@ -1,6 +1,9 @@
 #include "spriteeditorwindow.h"
 #include "ui_spriteeditorwindow.h"
 #include <QGridLayout>
+#include <QScrollArea>
+#include <QInputDialog>
+#include <QDockWidget>
 
 SpriteEditorWindow::SpriteEditorWindow(QWidget *parent, SpriteModel *model) :
     QMainWindow(parent),
@@ -9,6 +12,22 @@ SpriteEditorWindow::SpriteEditorWindow(QWidget *parent, SpriteModel *model) :
     ui->setupUi(this);
     previewTimer = new QTimer(this);
 
+    // The one widget that draws whichever frame is current. Sprites too big to fit
+    // scroll, and only the part in view gets painted.
+    canvas = new Canvas(this);
+    canvas->setHistory(model->getHistory());
+    QScrollArea* canvasScrollArea = new QScrollArea(this);
+    canvasScrollArea->setWidget(canvas);
+    canvasScrollArea->setFocusPolicy(Qt::NoFocus);
+    ui->frameLayout->addWidget(canvasScrollArea, 0, 0);
+
+    // The layers of the current frame
+    layerPanel = new LayerPanel(this);
+    QDockWidget* layerDock = new QDockWidget(tr("Layers"), this);
+    layerDock->setWidget(layerPanel);
+    addDockWidget(Qt::RightDockWidgetArea, layerDock);
+    frames = nullptr;
+
     //Listen for signals from view
     QObject::connect(previewTimer, SIGNAL(timeout()),this,SLOT(updatePreviewImage()));
     QObject::connect(ui->addFrameButton, &QPushButton::pressed,
@@ -25,12 +44,16 @@ SpriteEditorWindow::SpriteEditorWindow(QWidget *parent, SpriteModel *model) :
                     this, &SpriteEditorWindow::handleItemClicked);
     QObject::connect(this, &SpriteEditorWindow::resolutionSliderMovedSignal,
                     model, &SpriteModel::changeResolutionOfAllFrames);
+    QObject::connect(this, &SpriteEditorWindow::canvasSizeChosen,
+                    model, &SpriteModel::resizeCanvas);
+    QObject::connect(this, &SpriteEditorWindow::fillRequested,
+                    model, &SpriteModel::floodFill);
     QObject::connect(this, &SpriteEditorWindow::drawMirroredBoxChangedSignal,
-                    model, &SpriteModel::setDrawMirrored);
+                    canvas, &Canvas::setDrawMirrored);
+    QObject::connect(ui->actionFloatSelection, &QAction::toggled,
+                    canvas, &Canvas::setFloatingSelection);
     QObject::connect(ui->popOutButton, &QPushButton::pressed,
                     model, &SpriteModel::getFrames);
-    QObject::connect(this, &SpriteEditorWindow::updateAnimation,
-                    model, &SpriteModel::updateImages);
     QObject::connect(ui->itemUpButton, &QPushButton::pressed,
                     [=]() {swapItem(false);});
     QObject::connect(ui->itemDownButton, &QPushButton::pressed,
@@ -43,22 +66,52 @@ SpriteEditorWindow::SpriteEditorWindow(QWidget *parent, SpriteModel *model) :
                       model, &SpriteModel::load);
     QObject::connect(ui->actionExport,&QAction::triggered,
             model, &SpriteModel::exportGif);
+    QObject::connect(ui->actionExportAtlas, &QAction::triggered,
+                      model, &SpriteModel::exportAtlas);
+    QObject::connect(ui->actionDeltaFrames, &QAction::toggled,
+                      model, &SpriteModel::setDeltaFrames);
+    QObject::connect(layerPanel, &LayerPanel::layerAdded,
+                      model, &SpriteModel::addLayer);
+    QObject::connect(layerPanel, &LayerPanel::layerRemoved,
+                      model, &SpriteModel::removeLayer);
+    QObject::connect(layerPanel, &LayerPanel::layerMoved,
+                      model, &SpriteModel::moveLayer);
+    QObject::connect(layerPanel, &LayerPanel::currentLayerChanged,
+                      model, &SpriteModel::setCurrentLayer);
+    QObject::connect(layerPanel, &LayerPanel::layerOpacityChanged,
+                      model, &SpriteModel::setLayerOpacity);
+    QObject::connect(layerPanel, &LayerPanel::layerVisibilityChanged,
+                      model, &SpriteModel::setLayerVisible);
+    QObject::connect(this, &SpriteEditorWindow::undoRequested,
+                      model, &SpriteModel::undo);
+    QObject::connect(this, &SpriteEditorWindow::redoRequested,
+                      model, &SpriteModel::redo);
+    QObject::connect(this, &SpriteEditorWindow::taskCancelRequested,
+                      model, &SpriteModel::cancelTask);
 
 
 
     // Listen for signals from model
     QObject::connect(model, &SpriteModel::frameAdded,
                     this, &SpriteEditorWindow::handleAddedFrame);
+    QObject::connect(model, &SpriteModel::framesLoaded,
+                    this, &SpriteEditorWindow::handleLoadedFrames);
     QObject::connect(model, &SpriteModel::frameDuplicated,
                     this, &SpriteEditorWindow::handleDuplicatedFrame);
     QObject::connect(model, &SpriteModel::currentFrameUpdated,
                     this, &SpriteEditorWindow::updateFrame);
     QObject::connect(model, &SpriteModel::sendFrames,
                     this, &SpriteEditorWindow::receiveFrames);
+    QObject::connect(model, &SpriteModel::taskStarted,
+                    this, &SpriteEditorWindow::handleTaskStarted);
+    QObject::connect(model, &SpriteModel::taskProgressed,
+                    this, &SpriteEditorWindow::handleTaskProgressed);
+    QObject::connect(model, &SpriteModel::taskFinished,
+                    this, &SpriteEditorWindow::handleTaskFinished);
 
     // Setting up the color picker color
     penColor = Qt::black;
-    currentFrame = nullptr;
+    taskProgress = nullptr;
 
     // We initialize first frame here instead of the model constructor because the constructor
     // executes before the signals are connected.
@@ -71,16 +124,36 @@ SpriteEditorWindow::SpriteEditorWindow(QWidget *parent, SpriteModel *model) :
 
     previewTimer->start(1000/fps);
 
+    // A sprite left unsaved by a crash comes back in place of the blank one
+    model->recoverAutosave();
 }
 
 SpriteEditorWindow::~SpriteEditorWindow()
 {
-    // Current frame points to a frame from model, so to avoid double deletion, we just set ours to nullptr
-    // and let the parent handle deletion.
-    currentFrame = nullptr;
+    // The frames belong to the model, so we just forget about them
+    frames = nullptr;
     delete ui;
 }
 
+void SpriteEditorWindow::handleLoadedFrames(int count)
+{
+    // All the names go in at once, so opening a long animation doesn't relayout the list per frame
+    QStringList frameNames;
+    frameNames.reserve(count);
+    for (int frame = 1; frame <= count; frame++)
+    {
+        frameNames.append(QString("Frame %1").arg(frame));
+    }
+
+    ui->framesList->clear();
+    ui->framesList->addItems(frameNames);
+    ui->framesList->setCurrentRow(0);
+
+    currentFrameIndex = 0;
+    emit updateCurrentFrameIndex(0);
+    updateButtonsToDisable();
+}
+
 void SpriteEditorWindow::handleAddedFrame(int framesMade)
 {
     // The syntax for interpolating an int in a QString
@@ -103,7 +176,6 @@ void SpriteEditorWindow::handleRemovedFrame()
     int removedIndex = ui->framesList->currentRow();
     ui->framesList->takeItem(removedIndex);
     int newIndex = ui->framesList->currentRow();
-    currentFrame->hide();
     previewTimer->stop();
     currentFrameIndex = 0;
     emit frameRemoved(removedIndex, newIndex);
@@ -134,17 +206,23 @@ void SpriteEditorWindow::updateButtonsToDisable()
     ui->itemDownButton->setDisabled(isLastRow);
 }
 
-void SpriteEditorWindow::updateFrame(Frame* newCurrent)
+void SpriteEditorWindow::updateFrame(Frame* newCurrent, int index)
 {
     if(!previewTimer->isActive())
     {
         previewTimer->start();
     }
 
-    ui->frameLayout->removeWidget(currentFrame);
-    currentFrame = newCurrent;
-    ui->frameLayout->addWidget(newCurrent, 0 , 0);
-    newCurrent->show();
+    canvas->setFrame(newCurrent, index);
+    layerPanel->showLayers(newCurrent);
+
+    // Undo can switch to a frame other than the selected one
+    currentFrameIndex = index;
+    if (ui->framesList->currentRow() != index && index < ui->framesList->count())
+    {
+        ui->framesList->setCurrentRow(index);
+        updateButtonsToDisable();
+    }
 }
 
 void SpriteEditorWindow::swapItem(bool isMoveDown)
@@ -173,7 +251,6 @@ void SpriteEditorWindow::swapItem(bool isMoveDown)
 
 void SpriteEditorWindow::handleItemClicked()
 {
-    currentFrame->hide();
     updatePreviewImage();
     emit updateCurrentFrameIndex(ui->framesList->currentRow());
 
@@ -197,72 +274,85 @@ void SpriteEditorWindow::on_chooseColorBox_clicked()
 
 void SpriteEditorWindow::mouseMoveEvent(QMouseEvent *event)
 {
-    if (ui->penButton->isChecked() && mousePressed)
+    QPoint framePosition = canvas->mapFrom(this, event->pos());
+
+    // The canvas buffers these and joins them up, so fast strokes have no gaps
+    if ((ui->penButton->isChecked() || ui->eraserButton->isChecked()) && mousePressed)
     {
-        currentFrame->drawPixel(event->x(),event->y(),penColor);
+        canvas->strokeTo(framePosition.x(),framePosition.y());
     }
-
-    if(ui->eraserButton->isChecked()){
-        currentFrame->drawPixel(event->x(),event->y(),qRgba(160 , 160, 160, 10));
+    else if (ui->selectionButton->isChecked() && mousePressed)
+    {
+        canvas->dragSelectionTo(framePosition.x(),framePosition.y());
     }
 }
 
 void SpriteEditorWindow::mousePressEvent(QMouseEvent *event)
 {
-    // 10 is the x offset of the frame and 26 is the y offset
-    bool isMouseInFrame = (event->x() >= 10 && event->x() <= 810 && event->y() >= 26 && event->x() <= 826);
-    if(isMouseInFrame)
-    {
-        mousePressed = true;
-        currentFrame->drawPixel(event->x(),event->y(),penColor);
-    }
-    QImage& image = currentFrame->getImage();
-    emit updateAnimation(currentFrameIndex, image);
+    // Mouse events arrive in window coordinates, the frame wants its own
+    QPoint framePosition = canvas->mapFrom(this, event->pos());
+    QPoint pixel = canvas->getPixelAtCoordinates(framePosition.x(), framePosition.y());
+    bool isCursorInDrawArea = canvas->getFrame()->contains(pixel.x(), pixel.y());
 
-    bool isCursorInDrawArea = (event->x() >= 12 && event->x() <= 812 && event->y() >=29 && event->y() <=829);
     if(ui->penButton->isChecked())
     {
         mousePressed = true;
 
-        currentFrame->drawPixel(event->x(),event->y(),penColor);
-        currentFrame->setIsPixelSelected(false);
+        // Drawing puts down whatever was floating first
+        canvas->anchorSelection();
+
+        // Everything drawn until the mouse is released is undone in one go
+        canvas->beginStroke(penColor);
+        canvas->strokeTo(framePosition.x(),framePosition.y());
     }
     else if(ui->eraserButton->isChecked())
     {
-        currentFrame->drawPixel(event->x(),event->y(),qRgba(160 , 160, 160, 10));
-        currentFrame->setIsPixelSelected(false);
+        mousePressed = true;
+
+        canvas->anchorSelection();
+        canvas->beginStroke(Qt::transparent);
+        canvas->strokeTo(framePosition.x(),framePosition.y());
+    }
+    else if(ui->bucketButton->isChecked() && isCursorInDrawArea)
+    {
+        canvas->anchorSelection();
+        emit fillRequested(pixel.x(), pixel.y(), penColor, ui->fillAllFramesCheckBox->isChecked());
     }
-    else if(ui->selectionButton->isChecked() && isCursorInDrawArea)
+    else if(ui->selectionButton->isChecked())
     {
-        currentFrame->setIsPixelSelected(true);
-        currentFrame->setCurrentSelectedX(event->x());
-        currentFrame->setCurrentSelectedY(event->y());
+        mousePressed = true;
 
-        // Draw a pixel at the current index with offset
-        currentFrame->setSelectedColor(currentFrame->getImage().pixelColor(event->x()-12, event->y()-29));
+        // Dragging inside the selection moves it, anywhere else draws a new one
+        canvas->beginSelection(framePosition.x(), framePosition.y());
     }
+
 }
 
 
 void SpriteEditorWindow::mouseReleaseEvent(QMouseEvent *event)
 {
     mousePressed = false;
+    canvas->endStroke();
+    canvas->endSelection();
     updatePreviewImage();
-    QImage& image = currentFrame->getImage();
-    emit updateAnimation(currentFrameIndex, image);
-
 }
 
 
 void SpriteEditorWindow::updatePreviewImage()
 {
-    if(frames.count() > 0)
+    if(frames != nullptr && frames->count() > 0)
     {
-        QImage image;
-        image = frames[imageIndex]->getImage();
+        // Frames may have been removed since the last tick
+        if (imageIndex >= frames->size())
+        {
+            imageIndex = 0;
+        }
 
-        // Scale our image to 200x200 size so we can display it in our preview window
-        QImage previewImage = image.scaled(200, 200, Qt::KeepAspectRatio);
+        const Frame& frame = frames->at(imageIndex);
+
+        // Scale our image to 200x200 size so we can display it in our preview window.
+        // Only the pixels that end up in the preview are read, however big the sprite is.
+        QImage previewImage = frame.toScaledImage(frame.getSize().scaled(200, 200, Qt::KeepAspectRatio));
         ui->previewLabel->setPixmap(QPixmap::fromImage(previewImage));
         ui->previewLabel->show();
 
@@ -273,7 +363,7 @@ void SpriteEditorWindow::updatePreviewImage()
 void SpriteEditorWindow::incrementImageIndex()
 {
     // If this is not the last image in the sequence
-    if (imageIndex < frames.size() - 1)
+    if (imageIndex < frames->size() - 1)
     {
         imageIndex++;
     }
@@ -304,7 +394,7 @@ void SpriteEditorWindow::on_popOutButton_clicked()
 
 }
 
-void SpriteEditorWindow::receiveFrames(QList<Frame*> frameList)
+void SpriteEditorWindow::receiveFrames(const QVector<Frame>* frameList)
 {
     frames = frameList;
     popup.setFrames(frameList);
@@ -338,74 +428,35 @@ void SpriteEditorWindow::on_frameRateSlider_sliderMoved(int position)
 
 void SpriteEditorWindow::keyPressEvent(QKeyEvent *event)
 {
-   
-}
-
-void SpriteEditorWindow::keyReleaseEvent(QKeyEvent *event)
-{
-    if(event->key() == Qt::Key_Up) // which arrow == 0
-    {
-        if(currentFrame->getCurrentSelectedY() < 35 + currentFrame->getCurrentPixelSize()/2)
-        {
-            return;
-        }
-        if(currentFrame->getIsPixelSelected())
-        {
-            //create  the setter for this variable
-            currentFrame->whichArrow = 0;
-            currentFrame->shiftPixel(currentFrame->getCurrentSelectedX(),currentFrame->getCurrentSelectedY(), currentFrame->getSelectedColor());
-            currentFrame->update();
-            currentFrame->setCurrentSelectedY(currentFrame->getCurrentSelectedY()-currentFrame->getCurrentPixelSize());
-
-        }
-    }
-
-    if(event->key() == Qt::Key_Down)
+    // Arrow keys nudge the selected block one sprite pixel at a time
+    switch (event->key())
     {
-        if(currentFrame->getCurrentSelectedY() > 815 - currentFrame->getCurrentPixelSize()/2)
-        {
-            return;
-        }
-        if(currentFrame->getIsPixelSelected())
-        {
-            currentFrame->whichArrow = 1;
-            currentFrame->shiftPixel(currentFrame->getCurrentSelectedX(),currentFrame->getCurrentSelectedY(), currentFrame->getSelectedColor());
-            currentFrame->update();
-            currentFrame->setCurrentSelectedY(currentFrame->getCurrentSelectedY()+currentFrame->getCurrentPixelSize());
-
-        }
-    }
-
-    if(event->key() == Qt::Key_Left)
-    {
-        if(currentFrame->getCurrentSelectedX() < 25+ currentFrame->getCurrentPixelSize()/2)
-        {
-            return;
-        }
-        if(currentFrame->getIsPixelSelected())
-        {
-            currentFrame->whichArrow = 2;
-            currentFrame->shiftPixel(currentFrame->getCurrentSelectedX(),currentFrame->getCurrentSelectedY(), currentFrame->getSelectedColor());
-            currentFrame->update();
-            currentFrame->setCurrentSelectedX(currentFrame->getCurrentSelectedX()-currentFrame->getCurrentPixelSize());
-
-        }
-    }
-
-    if(event->key() == Qt::Key_Right)
-    {
-        if(currentFrame->getCurrentSelectedX() > 800 - currentFrame->getCurrentPixelSize()/2)
-        {
-            return;
-        }
-        if(currentFrame->getIsPixelSelected())
-        {
-            currentFrame->whichArrow = 3;
-            currentFrame->shiftPixel(currentFrame->getCurrentSelectedX(),currentFrame->getCurrentSelectedY(), currentFrame->getSelectedColor());
-            currentFrame->update();
-            currentFrame->setCurrentSelectedX(currentFrame->getCurrentSelectedX()+currentFrame->getCurrentPixelSize());
-
-        }
+    case Qt::Key_Up:
+        canvas->moveSelection(0, -1);
+        break;
+    case Qt::Key_Down:
+        canvas->moveSelection(0, 1);
+        break;
+    case Qt::Key_Left:
+        canvas->moveSelection(-1, 0);
+        break;
+    case Qt::Key_Right:
+        canvas->moveSelection(1, 0);
+        break;
+    case Qt::Key_Return:
+    case Qt::Key_Enter:
+        canvas->anchorSelection();
+        break;
+    case Qt::Key_Escape:
+        canvas->clearSelection();
+        break;
+    case Qt::Key_Delete:
+    case Qt::Key_Backspace:
+        canvas->deleteSelection();
+        break;
+    default:
+        QMainWindow::keyPressEvent(event);
+        return;
     }
 
     updatePreviewImage();
@@ -415,21 +466,112 @@ void SpriteEditorWindow::on_actionSave_triggered()
 {
     //QFileDialog dialog(this);
      QString fileName = QFileDialog::getSaveFileName(this,tr("Save Sprite Sheet Project"), "", tr("Sprite Sheet Project (*.ssp)"));
+     if (fileName.isEmpty())
+         return;
      if (!fileName.endsWith(".ssp"))
          fileName += ".ssp";
     emit saveFrame(fileName);
 }
 
+void SpriteEditorWindow::handleTaskStarted(QString label, int steps)
+{
+    // Not modal, so drawing carries on while the task runs
+    taskProgress = new QProgressDialog(label, tr("Cancel"), 0, steps, this);
+    taskProgress->setWindowModality(Qt::NonModal);
+    taskProgress->setAutoClose(false);
+    taskProgress->setAutoReset(false);
+    taskProgress->setMinimumDuration(500);
+    QObject::connect(taskProgress, &QProgressDialog::canceled,
+                      this, &SpriteEditorWindow::taskCancelRequested);
+}
+
+void SpriteEditorWindow::handleTaskProgressed(int step)
+{
+    if (taskProgress != nullptr)
+    {
+        taskProgress->setValue(step);
+    }
+}
+
+void SpriteEditorWindow::handleTaskFinished()
+{
+    if (taskProgress != nullptr)
+    {
+        taskProgress->deleteLater();
+        taskProgress = nullptr;
+    }
+}
+
 void SpriteEditorWindow::on_actionOpen_triggered()
 {
-    currentFrame->hide();
-    ui->framesList->clear();
     QString fileName = QFileDialog::getOpenFileName(this,
             tr("Open Sprite Sheet Project"), "",
             tr("Sprite Sheet Project (*.ssp)"));
+    if (fileName.isEmpty())
+    {
+        return;
+    }
     emit loadFrame(fileName);
 }
 
+void SpriteEditorWindow::on_actionUndo_triggered()
+{
+    emit undoRequested();
+    updatePreviewImage();
+}
+
+void SpriteEditorWindow::on_actionRedo_triggered()
+{
+    emit redoRequested();
+    updatePreviewImage();
+}
+
+void SpriteEditorWindow::on_actionCut_triggered()
+{
+    canvas->cutSelection();
+    updatePreviewImage();
+}
+
+void SpriteEditorWindow::on_actionCopy_triggered()
+{
+    canvas->copySelection();
+}
+
+void SpriteEditorWindow::on_actionPaste_triggered()
+{
+    // Pasted pixels land where the selection is, so the selection tool can move them
+    ui->selectionButton->setChecked(true);
+    canvas->pasteSelection();
+    updatePreviewImage();
+}
+
+void SpriteEditorWindow::on_actionCanvasSize_triggered()
+{
+    Frame* current = canvas->getFrame();
+    if (current == nullptr)
+    {
+        return;
+    }
+
+    bool accepted = false;
+    int width = QInputDialog::getInt(this, tr("Canvas Size"), tr("Width in pixels:"),
+                                     current->getWidth(), 1, Frame::MAX_SIZE, 1, &accepted);
+    if (!accepted)
+    {
+        return;
+    }
+
+    int height = QInputDialog::getInt(this, tr("Canvas Size"), tr("Height in pixels:"),
+                                      current->getHeight(), 1, Frame::MAX_SIZE, 1, &accepted);
+    if (!accepted)
+    {
+        return;
+    }
+
+    emit canvasSizeChosen(width, height);
+    updatePreviewImage();
+}
+
 void SpriteEditorWindow::setFps(int newFps)
 {
     fps = newFps;
@@ -8,9 +8,12 @@
 #include <QSignalMapper>
 #include <QKeyEvent>
 #include <QFileDialog>
+#include <QProgressDialog>
 #include "frame.h"
+#include "canvas.h"
 #include "spritemodel.h"
 #include "popup.h"
+#include "layerpanel.h"
 
 namespace Ui {
 class SpriteEditorWindow;
@@ -23,35 +26,44 @@ class SpriteEditorWindow : public QMainWindow
 public:
     explicit SpriteEditorWindow(QWidget *parent = nullptr, SpriteModel *model = new SpriteModel());
     ~SpriteEditorWindow() override;
-    QList<Frame*> frames;
+    const QVector<Frame>* frames;
 
 signals:
     void updateCurrentFrameIndex(int index);
     void frameRemoved(int removedIndex, int newIndex);
     void resolutionSliderMovedSignal(int value);
+    void canvasSizeChosen(int width, int height);
+    void fillRequested(int x, int y, QColor color, bool allFrames);
     void drawMirroredBoxChangedSignal(bool checked);
-    void updateAnimation(int index, QImage& image);
     void frameRateSliderMoved(int newFps);
     void saveFrame(QString fileName);
     void loadFrame(QString fileName);
     void itemSwapped(int index, bool isDown);
+    void undoRequested();
+    void redoRequested();
+    void taskCancelRequested();
 
 
 public slots:
     void on_chooseColorBox_clicked();
     void handleAddedFrame(int framesMade);
+    void handleLoadedFrames(int count);
     void updatePreviewImage();
-    void receiveFrames(QList<Frame*> frames);
+    void receiveFrames(const QVector<Frame>* frames);
     void setFps(int newFps);
     void handleDuplicatedFrame();
-    void updateFrame(Frame* current);
+    void updateFrame(Frame* current, int index);
     void on_resolutionSlider_sliderMoved(int position);
     void on_drawMirrorCheckBox_toggled(bool checked);
+    void handleTaskStarted(QString label, int steps);
+    void handleTaskProgressed(int step);
+    void handleTaskFinished();
 
 private:
     Ui::SpriteEditorWindow *ui;
     QColor penColor;
-    Frame* currentFrame;
+    Canvas* canvas;
+    LayerPanel* layerPanel;
     int lastXPosition;
     int lastYPostion;
     int currentFrameIndex;
@@ -60,6 +72,8 @@ private:
     Popup popup;
     int fps;
     QTimer *previewTimer;
+    // Shows the save or export running in the background, null when there's none
+    QProgressDialog* taskProgress;
 
     void updateRemoveButton();
     void incrementImageIndex();
@@ -77,10 +91,15 @@ private slots:
     void on_popOutButton_clicked();
     void on_frameRateSlider_sliderMoved(int position);
     void swapItem(bool isDown);
-    void keyPressEvent(QKeyEvent *event);
-    void keyReleaseEvent(QKeyEvent *event);
+    void keyPressEvent(QKeyEvent *event) override;
     void on_actionSave_triggered();
     void on_actionOpen_triggered();
+    void on_actionUndo_triggered();
+    void on_actionRedo_triggered();
+    void on_actionCut_triggered();
+    void on_actionCopy_triggered();
+    void on_actionPaste_triggered();
+    void on_actionCanvasSize_triggered();
 };
 
 #endif // SPRITEEDITORWINDOW_H
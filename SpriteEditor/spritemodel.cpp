@@ -1,247 +1,536 @@
 #include "spritemodel.h"
-#include "gif.h"
+#include "projectfile.h"
+#include "exporter.h"
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QTextStream>
+#include <QThread>
+#include <QtConcurrent>
 #include <iostream>
 
 SpriteModel::SpriteModel()
 {
     framesMade = 0;
+    currentFrameIndex = 0;
+    canvasSize = QSize(32, 32);
+    deltaFrames = false;
+    autosave.setFrames(&frames);
+
+    connect(&task, SIGNAL(finished()), this, SLOT(finishTask()));
+    connect(&task, SIGNAL(progressValueChanged(int)), this, SIGNAL(taskProgressed(int)));
+
+    packTimer.setSingleShot(true);
+    packTimer.setInterval(0);
+    connect(&packTimer, SIGNAL(timeout()), this, SLOT(packIdleFrames()));
 }
 
 SpriteModel::~SpriteModel()
 {
-   for(int i = 0; i < frames.size(); i++)
-   {
-       delete frames[i];
-   }
-   frames.clear();
+    // Quitting during a save finishes it rather than losing it
+    task.waitForFinished();
+}
+
+EditHistory* SpriteModel::getHistory()
+{
+    return &history;
 }
 
 void SpriteModel::addFrame()
 {
-    frames.push_back(new Frame(nullptr, isDrawMirroredChecked));
-    frames[frames.size()-1]->changeResolution(currentPixelSize);
+    frames.push_back(Frame(canvasSize.width(), canvasSize.height()));
+    history.frameInserted(frames.size() - 1);
 
     // Adding a frame switches focus to that new frame
     framesMade++;
-    emit sendFrames(frames);
+    emit sendFrames(&frames);
     emit frameAdded(framesMade);
 }
 
 void SpriteModel::removeFrame(int removedIndex, int newIndex)
 {
-    delete frames[removedIndex];
     frames.removeAt(removedIndex);
-    emit sendFrames(frames);
+    history.frameRemoved(removedIndex);
+    emit sendFrames(&frames);
     setCurrentFrame(newIndex);
 }
 
 void SpriteModel::duplicateFrame(int index)
 {
-    Frame* original = frames[index];
-    Frame* copy = new Frame(*original,isDrawMirroredChecked);
+    Frame copy = frames[index];
 
     int newIndex = index + 1;
     frames.insert(newIndex, copy);
+    history.frameInserted(newIndex);
 
     framesMade++;
 
-    emit sendFrames(frames);
+    emit sendFrames(&frames);
     emit frameDuplicated();
 }
 
 void SpriteModel::setCurrentFrame(int selectedIndex)
 {
-    emit currentFrameUpdated(frames[selectedIndex]);
+    // Inserting or removing frames can move the others around in memory,
+    // so the view always gets a fresh pointer from here
+    currentFrameIndex = selectedIndex;
+
+    recentFrames.removeAll(currentFrameIndex);
+    recentFrames.prepend(currentFrameIndex);
+    while (recentFrames.size() > MAX_LOADED_FRAMES)
+    {
+        recentFrames.removeLast();
+    }
+
+    packIdleFrames();
+    emit currentFrameUpdated(&frames[selectedIndex], selectedIndex);
+}
+
+void SpriteModel::packIdleFrames()
+{
+    // Indexes in the list can go stale as frames move around, which at worst packs
+    // a frame early. Frames unchanged since they were last packed or opened just
+    // drop their layers, the rest need encoding.
+    QVector<int> changedFrames;
+    for (int i = 0; i < frames.size(); i++)
+    {
+        Frame& frame = frames[i];
+        if (frame.isLoaded() && !recentFrames.contains(i) && !frame.unload() && !frame.hasFloatingSelection())
+        {
+            changedFrames.append(i);
+        }
+    }
+
+    // After an edit to every frame they all need encoding. One frame per core is
+    // encoded at a time, and the rest wait for the next pass of the event loop.
+    int batchSize = std::max(1, QThread::idealThreadCount());
+    if (changedFrames.size() > batchSize)
+    {
+        changedFrames.resize(batchSize);
+        packTimer.start();
+    }
+
+    Frame* data = frames.data();
+    QtConcurrent::blockingMap(changedFrames, [=](int index)
+    {
+        data[index].pack();
+    });
 }
 
 void SpriteModel::changeResolutionOfAllFrames(int value)
 {
-    int scaleFactor = std::pow(2, value);
-    int newPixelSize = 200/scaleFactor;
+    int newSize = std::min(4 << value, Frame::MAX_SIZE);
 
-    currentPixelSize = newPixelSize;
+    if (QSize(newSize, newSize) == canvasSize)
+    {
+        return;
+    }
+
+    history.recordResolutionChange(canvasSize, QSize(newSize, newSize), frames);
+    canvasSize = QSize(newSize, newSize);
 
     for (int i = 0; i < frames.size(); i++)
     {
-        frames[i]->changeResolution(newPixelSize);
+        frames[i].changeResolution(newSize, newSize);
     }
+
+    setCurrentFrame(currentFrameIndex);
 }
 
-void SpriteModel::swapItem(int currentIndex, int newIndex)
+void SpriteModel::resizeCanvas(int width, int height)
 {
-    std::swap(frames[currentIndex], frames[newIndex]);
+    if (width < 1 || height < 1 || width > Frame::MAX_SIZE || height > Frame::MAX_SIZE
+            || QSize(width, height) == canvasSize)
+    {
+        return;
+    }
 
-    setCurrentFrame(newIndex);
+    history.recordResolutionChange(canvasSize, QSize(width, height), frames, false);
+    canvasSize = QSize(width, height);
+
+    // Only the tiles along the new right and bottom edges get touched
+    for (int i = 0; i < frames.size(); i++)
+    {
+        frames[i].resize(width, height);
+    }
+
+    setCurrentFrame(currentFrameIndex);
 }
 
-void SpriteModel::setDrawMirrored(bool checked)
+void SpriteModel::addLayer()
 {
-    isDrawMirroredChecked = checked;
+    Frame before = frames[currentFrameIndex];
+    Frame& frame = frames[currentFrameIndex];
 
-    for (int i = 0; i < frames.size(); i++)
-        frames[i]->setDrawMirrored(checked);
+    frame.addLayer(QString("Layer %1").arg(frame.getLayerCount() + 1));
+    history.recordFrameChange(currentFrameIndex, before, frame);
+    setCurrentFrame(currentFrameIndex);
 }
 
-void SpriteModel::getFrames()
+void SpriteModel::removeLayer(int index)
 {
-    emit sendFrames(frames);
+    Frame before = frames[currentFrameIndex];
+    Frame& frame = frames[currentFrameIndex];
+
+    if (frame.getLayerCount() <= 1 || index < 0 || index >= frame.getLayerCount())
+    {
+        return;
+    }
+
+    frame.removeLayer(index);
+    history.recordFrameChange(currentFrameIndex, before, frame);
+    setCurrentFrame(currentFrameIndex);
 }
 
-void SpriteModel::updateImages(int index, QImage& image)
+void SpriteModel::moveLayer(int from, int to)
 {
-    frames[index]->setImage(&image);
-    emit sendFrames(frames);
+    Frame before = frames[currentFrameIndex];
+    Frame& frame = frames[currentFrameIndex];
+
+    if (from == to || from < 0 || to < 0 || from >= frame.getLayerCount() || to >= frame.getLayerCount())
+    {
+        return;
+    }
+
+    frame.moveLayer(from, to);
+    history.recordFrameChange(currentFrameIndex, before, frame);
+    setCurrentFrame(currentFrameIndex);
 }
 
-void SpriteModel::save(QString fileName)
+void SpriteModel::setCurrentLayer(int index)
 {
-    QFile f( fileName );
-       int currentPixelSize = frames[0]->getCurrentPixelSize();
-       if ( f.open(QIODevice::WriteOnly) )
-       {
-           QTextStream outStream( &f );
+    // Only decides where the next stroke goes, nothing on screen changes
+    frames[currentFrameIndex].setCurrentLayerIndex(index);
+}
 
-       // store data in f
+void SpriteModel::setLayerOpacity(int index, int opacity)
+{
+    Frame before = frames[currentFrameIndex];
+    Frame& frame = frames[currentFrameIndex];
 
-   //       /* Write the line to the file */
-             outStream << GRID_RESOLUTION/currentPixelSize << " " << GRID_RESOLUTION/currentPixelSize << '\n';
-             outStream << frames.size() << '\n';
+    if (index < 0 || index >= frame.getLayerCount() || frame.getLayer(index).getOpacity() == opacity)
+    {
+        return;
+    }
 
-             for (int frameIndex = 0; frameIndex < frames.size(); frameIndex++)
-             {
-                 QImage image = frames[frameIndex]->getImage();
+    frame.setLayerOpacity(index, opacity);
+    history.recordFrameChange(currentFrameIndex, before, frame);
+    setCurrentFrame(currentFrameIndex);
+}
 
-                 for ( int x = 10; x < image.width(); x = x + currentPixelSize )
-                 {
-           for ( int y = 10; y < image.height(); y = y + currentPixelSize )
-           {
+void SpriteModel::setLayerVisible(int index, bool visible)
+{
+    Frame before = frames[currentFrameIndex];
+    Frame& frame = frames[currentFrameIndex];
 
-                       QColor clrCurrent( image.pixel( x, y ));
+    if (index < 0 || index >= frame.getLayerCount() || frame.getLayer(index).isVisible() == visible)
+    {
+        return;
+    }
 
-                       int red = clrCurrent.red();
-                       int green = clrCurrent.green();
-                       int blue = clrCurrent.blue();
-                       int alpha = clrCurrent.alpha();
+    frame.setLayerVisible(index, visible);
+    history.recordFrameChange(currentFrameIndex, before, frame);
+    setCurrentFrame(currentFrameIndex);
+}
 
-                       if (red == 160 && green == 160 && blue == 160 && alpha == 255)
-                       {
-                           red = 0;
-                           green = 0;
-                           blue = 0;
-                           alpha = 0;
-                       }
+void SpriteModel::floodFill(int x, int y, QColor color, bool allFrames)
+{
+    QRgb rgb = color.rgba();
 
-                       outStream << red << " " << green << " " <<
-                       blue << " " << alpha << " ";
-                   }
+    if (!allFrames)
+    {
+        Frame before = frames[currentFrameIndex];
 
-               outStream << "\n";
-           }
-          }
-       }
+        if (!frames[currentFrameIndex].floodFill(x, y, rgb).isEmpty())
+        {
+            history.recordFrameChange(currentFrameIndex, before, frames[currentFrameIndex]);
+            setCurrentFrame(currentFrameIndex);
+        }
+        return;
+    }
 
-       f.close();
+    // Frames share no pixels once written to, so each one can be filled on its own thread
+    QVector<Frame> before = frames;
+    QtConcurrent::blockingMap(frames, [=](Frame& frame)
+    {
+        if (frame.contains(x, y))
+        {
+            frame.floodFill(x, y, rgb);
+        }
+    });
 
+    history.recordAllFramesChange(before, frames);
+    setCurrentFrame(currentFrameIndex);
 }
 
-void SpriteModel::load(QString fileName)
+void SpriteModel::swapItem(int currentIndex, int newIndex)
 {
-    QFile f(fileName);
+    std::swap(frames[currentIndex], frames[newIndex]);
+    history.framesSwapped(currentIndex, newIndex);
 
-        // Stop the timer
-        frames.clear();
-        framesMade = 0;
+    setCurrentFrame(newIndex);
+}
 
-        if ( f.open(QIODevice::ReadOnly) )
-        {
-        QTextStream in(&f);
+void SpriteModel::getFrames()
+{
+    emit sendFrames(&frames);
+}
 
-        QString line = in.readLine();
-        QStringList fields = line.split(" ");
-        int currentPixelSize = GRID_RESOLUTION/fields[0].toInt();
-        int numberOfFrames = in.readLine().toInt();
+void SpriteModel::save(QString fileName)
+{
+    if (isTaskRunning())
+    {
+        return;
+    }
 
-        for (int frame = 0; frame < numberOfFrames; frame++)
-        {
-            current = new Frame();
-            current->setCurrentPixelSize(currentPixelSize);
-            //addFrame();
-            //Frame* current = frames[frame];
+    // An autosave still being written may be reading frames from the file, and
+    // frames opened from it are copied out of it here, where nothing else is reading them
+    autosave.waitForFinished();
+    ProjectFile::releaseSources(fileName, frames);
 
-            for (int column = 17; column < GRID_RESOLUTION; column = column + currentPixelSize)
-            {
-                int index = 0;
-                QStringList colorLine = in.readLine().split(" ");
-                for (int row = 48; row < GRID_RESOLUTION; row = row + currentPixelSize)
-                {
-                    QColor color;
+    QVector<Frame> snapshot = snapshotFrames();
+    bool delta = deltaFrames;
 
+    auto work = [=](QFutureInterface<QString>& progress) -> QString
+    {
+        QString error;
+        bool saved = ProjectFile::save(fileName, snapshot, &error, delta, [&](int done)
+        {
+            progress.setProgressValue(done);
+            return !progress.isCanceled();
+        });
 
-                    color.setRed(colorLine[index].toInt());
-                    color.setGreen(colorLine[index+1].toInt());
-                    color.setBlue(colorLine[index+2].toInt());
-                    color.setAlpha(colorLine[index+3].toInt());
+        return saved ? QString() : QString("Couldn't save %1: %2").arg(fileName, error);
+    };
 
-                    index += 4;
+    auto succeeded = [=]()
+    {
+        // Frames drawn on since the snapshot are left for the next autosave
+        autosave.discard();
+        autosave.setProjectFile(fileName);
+        autosave.markSaved(snapshot);
+    };
 
-                    //current->drawPixel(column, row, color);
-                    current->currentColor = color;
-                    current->currentXCoord = column;
-                    current->currentYCoord = row;
-                    current->updateForLoad();
+    startTask(QString("Saving %1").arg(fileName), "Save Failed", snapshot.size(), work, succeeded);
+}
+
+void SpriteModel::setDeltaFrames(bool enabled)
+{
+    deltaFrames = enabled;
+}
 
-                }
-            }
+void SpriteModel::load(QString fileName)
+{
+    if (isTaskRunning())
+    {
+        return;
+    }
 
-            frames.push_back(current);
+    QVector<Frame> loaded;
+    QString error;
 
-            framesMade++;
-            emit frameAdded(framesMade);
+    // Nothing is touched until the whole file has been read, so a bad file leaves the sprite as it was
+    if (!ProjectFile::load(fileName, loaded, &error))
+    {
+        QMessageBox::warning(NULL, "Open Failed", QString("Couldn't open %1: %2").arg(fileName, error));
+        return;
+    }
 
+    replaceFrames(loaded);
+    autosave.setProjectFile(fileName);
 
+    if (autosave.hasRecovery() && QMessageBox::question(NULL, "Recover Changes",
+            QString("%1 has autosaved changes that weren't saved. Recover them?").arg(fileName)) == QMessageBox::Yes)
+    {
+        QVector<Frame> recovered;
+        if (autosave.recover(recovered, &error))
+        {
+            replaceFrames(recovered);
+            return;
         }
 
+        QMessageBox::warning(NULL, "Recovery Failed", QString("Couldn't recover %1: %2").arg(fileName, error));
+    }
+
+    autosave.discard();
+    autosave.markSaved(frames);
+}
+
+void SpriteModel::recoverAutosave()
+{
+    if (!autosave.hasRecovery())
+    {
+        return;
+    }
+
+    if (QMessageBox::question(NULL, "Recover Sprite",
+            "The editor closed before the last sprite was saved. Recover it?") == QMessageBox::Yes)
+    {
+        QVector<Frame> recovered;
+        QString error;
+        if (autosave.recover(recovered, &error))
+        {
+            replaceFrames(recovered);
+            return;
         }
 
-        emit sendFrames(frames);
+        QMessageBox::warning(NULL, "Recovery Failed", QString("Couldn't recover the sprite: %1").arg(error));
+    }
+
+    autosave.discard();
+}
+
+void SpriteModel::replaceFrames(const QVector<Frame>& replacement)
+{
+    frames = replacement;
+    history.clear();
+    recentFrames.clear();
+    framesMade = frames.size();
+    canvasSize = frames[0].getSize();
+
+    emit sendFrames(&frames);
+    emit framesLoaded(frames.size());
+}
+
+void SpriteModel::undo()
+{
+    int changedIndex = history.undo(frames);
+
+    // Undoing a resolution change puts every frame back at the old size
+    canvasSize = frames[0].getSize();
+    setCurrentFrame(changedIndex >= 0 ? changedIndex : currentFrameIndex);
+}
+
+void SpriteModel::redo()
+{
+    int changedIndex = history.redo(frames);
 
+    canvasSize = frames[0].getSize();
+    setCurrentFrame(changedIndex >= 0 ? changedIndex : currentFrameIndex);
 }
 
-/*
-  quoted from https://github.com/ginsweater/gif-h/issues/3
- */
 void SpriteModel::exportGif()
 {
-        QString fileName = QFileDialog::getSaveFileName(NULL, "Spawn to", "", "GIF image (*.gif)");
+        if (isTaskRunning())
+        {
+            return;
+        }
 
+        QString fileName = QFileDialog::getSaveFileName(NULL, "Spawn to", "", "GIF image (*.gif)");
 
         if(!fileName.isEmpty())
         {
-            uint32_t frameSpeed = 100 / 10; // Half of second per frame
+            QVector<Frame> snapshot = snapshotFrames();
 
-            QImage &startImg = frames[0]->getImage();
+            auto work = [=](QFutureInterface<QString>& progress) -> QString
+            {
+                QString error;
+                bool exported = Exporter::writeGif(fileName, snapshot, Exporter::DEFAULT_DELAY, &error, [&](int done)
+                {
+                    progress.setProgressValue(done);
+                    return !progress.isCanceled();
+                });
 
-            GifWriter writer;
+                return exported ? QString() : error;
+            };
 
-            GifBegin(&writer, fileName.toUtf8().constData(), (uint32_t)startImg.width(), (uint32_t)startImg.height(), frameSpeed);
+            auto succeeded = []()
+            {
+                QMessageBox::information(NULL, "Done!", QString("GIF Image has been wrote!"));
+            };
+
+            startTask("Exporting GIF", "Export Failed", snapshot.size(), work, succeeded);
+        }
+}
 
+void SpriteModel::exportAtlas()
+{
+    if (isTaskRunning())
+    {
+        return;
+    }
 
-            for (Frame *currentFrame : frames)
-            {
-                QImage currentImage = currentFrame->getImage().rgbSwapped();
+    QString fileName = QFileDialog::getSaveFileName(NULL, "Export Atlas", "",
+                                                    "JSON frame table (*.json);;XML frame table (*.xml)");
+    if (fileName.isEmpty())
+    {
+        return;
+    }
 
+    QVector<Frame> snapshot = snapshotFrames();
 
-                QByteArray alpha8((char *)currentImage.bits(), currentImage.byteCount());
+    // Packing doesn't report how far along it is, so the dialog only shows it's busy
+    auto work = [=](QFutureInterface<QString>&) -> QString
+    {
+        QString error;
+        return Exporter::writeAtlas(fileName, snapshot, &error) ? QString() : error;
+    };
 
+    auto succeeded = []() {};
 
-                GifWriteFrame(&writer, (uint8_t *)alpha8.data(), currentImage.width(), currentImage.height(), frameSpeed);
-            }
+    startTask("Exporting atlas", "Export Failed", 0, work, succeeded);
+}
 
-            GifEnd(&writer);
+QVector<Frame> SpriteModel::snapshotFrames() const
+{
+    // Frames cache what they decode and composite as they're read, so the copy is
+    // detached to give the worker frames of its own rather than sharing these
+    QVector<Frame> snapshot = frames;
+    snapshot.detach();
+    return snapshot;
+}
 
-            QMessageBox::information(NULL, "Done!", QString("GIF Image has been wrote!"));
-        }
+bool SpriteModel::isTaskRunning()
+{
+    if (task.isRunning())
+    {
+        QMessageBox::information(NULL, "Busy", "Wait for the current save or export to finish first.");
+        return true;
+    }
+
+    return false;
+}
+
+void SpriteModel::startTask(const QString& label, const QString& failedTitle, int steps,
+                            std::function<QString(QFutureInterface<QString>&)> work, std::function<void()> succeeded)
+{
+    taskFailedTitle = failedTitle;
+    taskSucceeded = succeeded;
+
+    QFutureInterface<QString> progress;
+    progress.setProgressRange(0, steps);
+    progress.reportStarted();
+    task.setFuture(progress.future());
+    emit taskStarted(label, steps);
+
+    QtConcurrent::run([=]() mutable
+    {
+        QString error = work(progress);
+        progress.reportResult(error);
+        progress.reportFinished();
+    });
+}
+
+void SpriteModel::finishTask()
+{
+    emit taskFinished();
+
+    // Canceled tasks clean up after themselves and have nothing to report
+    if (task.isCanceled())
+    {
+        return;
+    }
+
+    QString error = task.result();
+    if (!error.isEmpty())
+    {
+        QMessageBox::warning(NULL, taskFailedTitle, error);
+        return;
+    }
+
+    taskSucceeded();
+}
+
+void SpriteModel::cancelTask()
+{
+    task.cancel();
 }
@@ -6,7 +6,13 @@
 #include <cmath>
 #include <algorithm>
 #include <QFile>
+#include <QFutureWatcher>
+#include <QFutureInterface>
+#include <QTimer>
+#include <functional>
 #include "frame.h"
+#include "edithistory.h"
+#include "autosave.h"
 
 
 class SpriteModel : public QObject
@@ -16,26 +22,89 @@ class SpriteModel : public QObject
 private:
     //QList<QImage> images;
     int currentFrameIndex;
-    QList<Frame*> frames;
+    QVector<Frame> frames;
     int frameRate;
     int framesMade;
-    int currentPixelSize = 25;
-    bool isDrawMirroredChecked = false;
-    const int GRID_RESOLUTION = 800;
-    Frame* current;
+    // Every frame is this size, in sprite pixels
+    QSize canvasSize;
+    // Whether projects are saved with frames as deltas from the ones before them
+    bool deltaFrames;
+    EditHistory history;
+
+    // Only the most recently shown frames are kept decoded, the others are packed
+    // into chunks and decoded again when next shown
+    static const int MAX_LOADED_FRAMES = 16;
+    QList<int> recentFrames;
+
+    // Frames changed since they were last packed need encoding, which is done a
+    // batch at a time from the event loop so the window stays responsive
+    QTimer packTimer;
+
+    // Journals changed frames in the background, see Autosave
+    Autosave autosave;
+
+    // The save or export running in the background, at most one at a time. Its
+    // result is an error message, empty if it succeeded.
+    QFutureWatcher<QString> task;
+    QString taskFailedTitle;
+    std::function<void()> taskSucceeded;
 
     void adjustToAvailableFrame(int index);
+    void replaceFrames(const QVector<Frame>& replacement);
+
+    /**
+     * Returns a copy of the frames that a worker thread can read while these
+     * keep changing. Only the frames are copied, their tiles are shared.
+     */
+    QVector<Frame> snapshotFrames() const;
+
+    /**
+     * Returns true, telling the user to wait, if a save or export is running.
+     */
+    bool isTaskRunning();
+
+    /**
+     * Runs work on a worker thread, reporting progress out of steps. The work
+     * must only read a snapshot of the frames, never the frames themselves.
+     * succeeded is called back on this thread if the work finishes without an
+     * error and isn't canceled.
+     */
+    void startTask(const QString& label, const QString& failedTitle, int steps,
+                   std::function<QString(QFutureInterface<QString>&)> work, std::function<void()> succeeded);
+
+private slots:
+    void finishTask();
+
+    /**
+     * Drops the layers of frames not shown lately that are unchanged since they
+     * were opened or packed, and packs one batch of the changed ones, coming
+     * back for the next batch until there are none left.
+     */
+    void packIdleFrames();
 
 public:
     SpriteModel();
     ~SpriteModel();
+
+    /**
+     *  The undo history of the frames, for the canvas to record strokes into.
+     */
+    EditHistory* getHistory();
     
 signals:
     // Lets view know a frame was added and gives it the count of frames
     void frameAdded(int count);  
-    void sendFrames(QList<Frame*> frames);
+    // Sent once when a project is opened, in place of a frameAdded per frame
+    void framesLoaded(int count);
+    // The frames stay owned by the model, receivers may keep the pointer
+    void sendFrames(const QVector<Frame>* frames);
     void frameDuplicated();
-    void currentFrameUpdated(Frame* current);
+    void currentFrameUpdated(Frame* current, int index);
+
+    // A save or export started, moved on, or ended. Drawing carries on meanwhile.
+    void taskStarted(QString label, int steps);
+    void taskProgressed(int step);
+    void taskFinished();
 
 public slots:
     /**
@@ -43,11 +112,25 @@ public slots:
      * its corresponding list.
      */
     void addFrame();
+    /**
+     * Scales every frame to one of the preset square sizes, 4 << value pixels
+     * on a side.
+     */
     void changeResolutionOfAllFrames(int value);
-    void setDrawMirrored(bool checked);
+
+    /**
+     * Crops or extends every frame to width x height without scaling the drawing.
+     * Sizes outside 1 to Frame::MAX_SIZE are ignored.
+     */
+    void resizeCanvas(int width, int height);
     void swapItem(int currentIndex, int newIndex);
     void exportGif();
 
+    /**
+     * Exports the frames as a packed texture atlas, see Atlas.
+     */
+    void exportAtlas();
+
 
     /**
      * Removes the frame at the selected index. Guranteed that
@@ -69,12 +152,49 @@ public slots:
 
     void getFrames();
 
-    void updateImages(int index, QImage& image);
-
+    /**
+     * Saves a snapshot of the frames in the background.
+     */
     void save(QString fileName);
+    void setDeltaFrames(bool enabled);
 
     void load(QString fileName);
 
+    /**
+     * Offers to recover the autosave of an untitled project left by a crash,
+     * for when the editor starts.
+     */
+    void recoverAutosave();
+
+    /**
+     * Stops the running save or export, leaving any file it was replacing alone.
+     */
+    void cancelTask();
+
+    /**
+     * Layer changes to the current frame. Layer indexes count from the bottom
+     * of the stack. Everything but picking the current layer can be undone.
+     */
+    void addLayer();
+    void removeLayer(int index);
+    void moveLayer(int from, int to);
+    void setCurrentLayer(int index);
+    void setLayerOpacity(int index, int opacity);
+    void setLayerVisible(int index, bool visible);
+
+    /**
+     * Bucket fills the current layer from sprite pixel x, y with color. With
+     * allFrames, every frame is filled from the same pixel, in parallel, as one
+     * undo step.
+     */
+    void floodFill(int x, int y, QColor color, bool allFrames);
+
+    /**
+     *  Undoes or redoes the newest edit and makes the frame it changed current.
+     */
+    void undo();
+    void redo();
+
 };
 
 #endif // SPRITEMODEL_H